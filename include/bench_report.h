@@ -0,0 +1,357 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  bench_report.h
+ *
+ *    Description:  Machine-readable results for the benchmark drivers. A
+ *                  report holds the run configuration and, for every phase
+ *                  and load point, the throughput of each repeated run. It is
+ *                  written as JSON or CSV (picked by the file extension) with
+ *                  the median, mean, standard deviation, min and max, and
+ *                  read back by bench_compare.
+ *
+ *                  The JSON writer puts each result on one line, which is
+ *                  what bench_report_read expects; it is not a general JSON
+ *                  parser.
+ *
+ * ============================================================================
+ */
+
+#ifndef _BENCH_REPORT_H_
+#define _BENCH_REPORT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef struct bench_result {
+   std::string phase;
+   // x value of the phase: the load factor in percent, or log2 of the slots
+   // in a size sweep
+   double point;
+   std::string unit;
+   std::vector<double> values;
+
+   // filled in by bench_result_stats, or read from a file
+   double median, mean, stddev, min, max;
+   uint64_t runs;
+} bench_result;
+
+typedef struct bench_report {
+   std::vector<std::pair<std::string, std::string> > config;
+   std::vector<bench_result> results;
+} bench_report;
+
+static inline void bench_report_config(bench_report *r, const char *key, const std::string& value) {
+   for (size_t i = 0; i < r->config.size(); i++) {
+      if (r->config[i].first == key) {
+         r->config[i].second = value;
+         return;
+      }
+   }
+   r->config.push_back(std::make_pair(std::string(key), value));
+}
+
+static inline void bench_report_config(bench_report *r, const char *key, double value) {
+   char buf[64];
+   snprintf(buf, sizeof(buf), "%.15g", value);
+   bench_report_config(r, key, std::string(buf));
+}
+
+// Appends the value of one run to the result of phase at point.
+static inline void bench_report_add(bench_report *r, const char *phase, double point,
+      const char *unit, double value) {
+   for (size_t i = 0; i < r->results.size(); i++) {
+      if (r->results[i].phase == phase && r->results[i].point == point) {
+         r->results[i].values.push_back(value);
+         return;
+      }
+   }
+   bench_result result;
+   result.phase = phase;
+   result.point = point;
+   result.unit = unit;
+   result.values.push_back(value);
+   r->results.push_back(result);
+}
+
+static inline void bench_result_stats(bench_result *res) {
+   std::vector<double> v = res->values;
+   std::sort(v.begin(), v.end());
+   uint64_t n = v.size();
+   double sum = 0, squares = 0;
+
+   res->runs = n;
+   if (n == 0) {
+      res->median = res->mean = res->stddev = res->min = res->max = 0;
+      return;
+   }
+   for (uint64_t i = 0; i < n; i++)
+      sum += v[i];
+   res->mean = sum / n;
+   for (uint64_t i = 0; i < n; i++)
+      squares += (v[i] - res->mean) * (v[i] - res->mean);
+   // sample standard deviation
+   res->stddev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+   res->median = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+   res->min = v[0];
+   res->max = v[n - 1];
+}
+
+// True if s is a finite number in JSON's decimal syntax, so it can be
+// written unquoted; inf, nan and hex are strings.
+static inline bool bench_is_number(const std::string& s) {
+   const char *p = s.c_str();
+   if (*p == '-')
+      p++;
+   if (!isdigit((unsigned char)*p) || (*p == '0' && isdigit((unsigned char)p[1])))
+      return false;
+   while (isdigit((unsigned char)*p))
+      p++;
+   if (*p == '.') {
+      if (!isdigit((unsigned char)*++p))
+         return false;
+      while (isdigit((unsigned char)*p))
+         p++;
+   }
+   if (*p == 'e' || *p == 'E') {
+      p++;
+      if (*p == '+' || *p == '-')
+         p++;
+      if (!isdigit((unsigned char)*p))
+         return false;
+      while (isdigit((unsigned char)*p))
+         p++;
+   }
+   return *p == '\0' && isfinite(strtod(s.c_str(), NULL));
+}
+
+// Writes s as a quoted JSON string.
+static inline void bench_json_string(FILE *fp, const std::string& s) {
+   fputc('"', fp);
+   for (size_t i = 0; i < s.size(); i++) {
+      unsigned char c = s[i];
+      if (c == '"' || c == '\\')
+         fprintf(fp, "\\%c", c);
+      else if (c == '\n')
+         fputs("\\n", fp);
+      else if (c == '\t')
+         fputs("\\t", fp);
+      else if (c < 0x20)
+         fprintf(fp, "\\u%04x", c);
+      else
+         fputc(c, fp);
+   }
+   fputc('"', fp);
+}
+
+static inline void bench_write_json(FILE *fp, bench_report *r) {
+   fprintf(fp, "{\n  \"config\": {\n");
+   for (size_t i = 0; i < r->config.size(); i++) {
+      const std::string& v = r->config[i].second;
+      fputs("    ", fp);
+      bench_json_string(fp, r->config[i].first);
+      fputs(": ", fp);
+      if (bench_is_number(v))
+         fputs(v.c_str(), fp);
+      else
+         bench_json_string(fp, v);
+      fprintf(fp, "%s\n", i + 1 < r->config.size() ? "," : "");
+   }
+   fprintf(fp, "  },\n  \"results\": [\n");
+   for (size_t i = 0; i < r->results.size(); i++) {
+      bench_result *res = &r->results[i];
+      bench_result_stats(res);
+      fputs("    {\"phase\": ", fp);
+      bench_json_string(fp, res->phase);
+      fprintf(fp, ", \"point\": %g, \"unit\": ", res->point);
+      bench_json_string(fp, res->unit);
+      fprintf(fp, ", \"runs\": %lu, \"median\": %.6g, \"mean\": %.6g, \"stddev\": %.6g, "
+            "\"min\": %.6g, \"max\": %.6g, \"values\": [", res->runs, res->median, res->mean,
+            res->stddev, res->min, res->max);
+      for (size_t j = 0; j < res->values.size(); j++)
+         fprintf(fp, "%s%.6g", j ? ", " : "", res->values[j]);
+      fprintf(fp, "]}%s\n", i + 1 < r->results.size() ? "," : "");
+   }
+   fprintf(fp, "  ]\n}\n");
+}
+
+// One row per result, each carrying the full configuration.
+static inline void bench_write_csv(FILE *fp, bench_report *r) {
+   for (size_t i = 0; i < r->config.size(); i++)
+      fprintf(fp, "%s,", r->config[i].first.c_str());
+   fprintf(fp, "phase,point,unit,runs,median,mean,stddev,min,max\n");
+   for (size_t i = 0; i < r->results.size(); i++) {
+      bench_result *res = &r->results[i];
+      bench_result_stats(res);
+      for (size_t j = 0; j < r->config.size(); j++)
+         fprintf(fp, "%s,", r->config[j].second.c_str());
+      fprintf(fp, "%s,%g,%s,%lu,%.6g,%.6g,%.6g,%.6g,%.6g\n", res->phase.c_str(), res->point,
+            res->unit.c_str(), res->runs, res->median, res->mean, res->stddev, res->min,
+            res->max);
+   }
+}
+
+static inline bool bench_is_csv(const char *filename) {
+   size_t n = strlen(filename);
+   return n >= 4 && strcmp(filename + n - 4, ".csv") == 0;
+}
+
+static inline bool bench_report_write(bench_report *r, const char *filename) {
+   FILE *fp = fopen(filename, "w");
+   if (fp == NULL) {
+      fprintf(stderr, "Can't open %s\n", filename);
+      return false;
+   }
+   if (bench_is_csv(filename))
+      bench_write_csv(fp, r);
+   else
+      bench_write_json(fp, r);
+   fclose(fp);
+   return true;
+}
+
+// The value of "key" in a line written by bench_write_json, unquoted and
+// unescaped.
+static inline bool bench_json_field(const char *line, const char *key, std::string *value) {
+   std::string pattern = std::string("\"") + key + "\": ";
+   const char *p = strstr(line, pattern.c_str());
+   if (p == NULL)
+      return false;
+   p += pattern.size();
+   if (*p != '"') {
+      value->assign(p, strcspn(p, ",}\n"));
+      return true;
+   }
+   value->clear();
+   for (p++; *p != '"'; p++) {
+      if (*p == '\0')
+         return false;
+      if (*p != '\\') {
+         *value += *p;
+         continue;
+      }
+      switch (*++p) {
+         case '\0':
+            return false;
+         case 'n':
+            *value += '\n';
+            break;
+         case 't':
+            *value += '\t';
+            break;
+         case 'u':
+            if (strlen(p + 1) < 4)
+               return false;
+            *value += (char)strtoul(std::string(p + 1, 4).c_str(), NULL, 16);
+            p += 4;
+            break;
+         default:
+            *value += *p;
+      }
+   }
+   return true;
+}
+
+static inline std::vector<std::string> bench_split_csv(const char *line) {
+   std::vector<std::string> fields;
+   std::string field;
+   for (const char *p = line; *p && *p != '\n'; p++) {
+      if (*p == ',') {
+         fields.push_back(field);
+         field.clear();
+      } else {
+         field += *p;
+      }
+   }
+   fields.push_back(field);
+   return fields;
+}
+
+// Reads the configuration and result statistics of a file written by
+// bench_report_write; the per-run values are not read back.
+static inline bool bench_report_read(bench_report *r, const char *filename) {
+   FILE *fp = fopen(filename, "r");
+   char line[1 << 16];
+   if (fp == NULL) {
+      fprintf(stderr, "Can't open %s\n", filename);
+      return false;
+   }
+
+   if (bench_is_csv(filename)) {
+      std::vector<std::string> header;
+      while (fgets(line, sizeof(line), fp)) {
+         std::vector<std::string> fields = bench_split_csv(line);
+         if (header.empty()) {
+            header = fields;
+            continue;
+         }
+         if (fields.size() != header.size() || header.size() < 9)
+            continue;
+         size_t nconfig = header.size() - 9;
+         for (size_t i = 0; i < nconfig; i++)
+            bench_report_config(r, header[i].c_str(), fields[i]);
+         bench_result res;
+         res.phase = fields[nconfig];
+         res.point = atof(fields[nconfig + 1].c_str());
+         res.unit = fields[nconfig + 2];
+         res.runs = strtoull(fields[nconfig + 3].c_str(), NULL, 10);
+         res.median = atof(fields[nconfig + 4].c_str());
+         res.mean = atof(fields[nconfig + 5].c_str());
+         res.stddev = atof(fields[nconfig + 6].c_str());
+         res.min = atof(fields[nconfig + 7].c_str());
+         res.max = atof(fields[nconfig + 8].c_str());
+         r->results.push_back(res);
+      }
+   } else {
+      bool in_config = false;
+      while (fgets(line, sizeof(line), fp)) {
+         std::string v;
+         if (strstr(line, "\"config\": {") != NULL) {
+            in_config = true;
+         } else if (in_config) {
+            // one "key": value per line up to the closing brace
+            const char *key = strchr(line, '"');
+            const char *key_end = key ? strchr(key + 1, '"') : NULL;
+            if (key_end == NULL) {
+               in_config = false;
+               continue;
+            }
+            std::string name(key + 1, key_end - key - 1);
+            if (bench_json_field(line, name.c_str(), &v))
+               bench_report_config(r, name.c_str(), v);
+         } else if (bench_json_field(line, "phase", &v)) {
+            bench_result res;
+            res.phase = v;
+            bench_json_field(line, "point", &v);
+            res.point = atof(v.c_str());
+            bench_json_field(line, "unit", &res.unit);
+            bench_json_field(line, "runs", &v);
+            res.runs = strtoull(v.c_str(), NULL, 10);
+            bench_json_field(line, "median", &v);
+            res.median = atof(v.c_str());
+            bench_json_field(line, "mean", &v);
+            res.mean = atof(v.c_str());
+            bench_json_field(line, "stddev", &v);
+            res.stddev = atof(v.c_str());
+            bench_json_field(line, "min", &v);
+            res.min = atof(v.c_str());
+            bench_json_field(line, "max", &v);
+            res.max = atof(v.c_str());
+            r->results.push_back(res);
+         }
+      }
+   }
+   fclose(fp);
+   return true;
+}
+
+#endif	// _BENCH_REPORT_H_
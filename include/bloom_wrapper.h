@@ -0,0 +1,82 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  bloom_wrapper.h
+ *
+ *    Description:  Register-blocked Bloom filter baseline for bm (Putze,
+ *                  Sanders and Singler, "Cache-, hash- and space-efficient
+ *                  Bloom filters", 2007). Each key sets BLOOM_K bits of one
+ *                  64-bit word, so an operation touches a single word. It
+ *                  gets the same number of bytes as a VQF of the same nslots
+ *                  and cannot remove.
+ *
+ * ============================================================================
+ */
+
+#ifndef BLOOM_WRAPPER_H
+#define BLOOM_WRAPPER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vqf_filter.h"
+#include "vqf_inline.h"
+#include "zipf.h"
+
+// Bits set per key. With about 19 bits per item at 95% of the VQF's load,
+// more bits crowd the one word a key maps to.
+#define BLOOM_K 8
+
+uint64_t *bf_words;
+uint64_t bf_nwords;
+
+static inline uint64_t bf_mask(uint64_t h) {
+	uint64_t bits = mix64(h), mask = 0;
+	for (int i = 0; i < BLOOM_K; i++, bits >>= 6)
+		mask |= 1ULL << (bits & 63);
+	return mask;
+}
+
+static inline uint64_t *bf_word(uint64_t h) {
+	return &bf_words[(uint64_t)(((__uint128_t)h * bf_nwords) >> 64)];
+}
+
+inline int bf_init(uint64_t nbits)
+{
+	uint64_t nslots = (1ULL << nbits);
+	uint64_t nblocks = (nslots + QUQU_SLOTS_PER_BLOCK) / QUQU_SLOTS_PER_BLOCK;
+	bf_nwords = nblocks * sizeof(vqf_block) / sizeof(uint64_t);
+	bf_words = (uint64_t *)calloc(bf_nwords, sizeof(uint64_t));
+	return bf_words == NULL;
+}
+
+inline int bf_insert(__uint128_t val)
+{
+	uint64_t h = mix64((uint64_t)val);
+	*bf_word(h) |= bf_mask(h);
+	return 1;
+}
+
+inline int bf_lookup(__uint128_t val)
+{
+	uint64_t h = mix64((uint64_t)val), mask = bf_mask(h);
+	return (*bf_word(h) & mask) == mask;
+}
+
+inline __uint128_t bf_range()
+{
+	return UINT64_MAX;
+}
+
+inline uint64_t bf_bytes()
+{
+	return bf_nwords * sizeof(uint64_t);
+}
+
+inline int bf_destroy()
+{
+	free(bf_words);
+	return 0;
+}
+
+#endif
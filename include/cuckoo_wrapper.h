@@ -0,0 +1,178 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  cuckoo_wrapper.h
+ *
+ *    Description:  Cuckoo filter baseline for bm (Fan, Andersen, Kaminsky
+ *                  and Mitzenmacher, "Cuckoo filter: practically better than
+ *                  Bloom", 2014). Buckets of four 16-bit fingerprints fill the
+ *                  same number of bytes as a VQF of the same nslots, so both
+ *                  spend the same bits per item.
+ *
+ *                  The bucket count need not be a power of two: the
+ *                  alternate bucket is hash(fingerprint) - i modulo the
+ *                  bucket count, which maps each bucket of a pair to the
+ *                  other. An insert that runs out of kicks parks the last
+ *                  evicted fingerprint in a one-entry stash, as the
+ *                  reference implementation does, and later inserts fail
+ *                  until a remove makes room for it.
+ *
+ * ============================================================================
+ */
+
+#ifndef CUCKOO_WRAPPER_H
+#define CUCKOO_WRAPPER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "vqf_filter.h"
+#include "vqf_inline.h"
+#include "zipf.h"
+
+#define CUCKOO_SLOTS 4
+#define CUCKOO_MAX_KICKS 500
+
+typedef struct cuckoo_stash {
+	bool used;
+	uint64_t bucket;
+	uint16_t fp;
+} cuckoo_stash;
+
+uint16_t (*ck_buckets)[CUCKOO_SLOTS];
+uint64_t ck_nbuckets;
+cuckoo_stash ck_stash;
+uint64_t ck_kick_state;
+
+static inline uint64_t ck_reduce(uint64_t h) {
+	return (uint64_t)(((__uint128_t)h * ck_nbuckets) >> 64);
+}
+
+// The low bits of the hash; the high bits pick the bucket. 0 marks an empty
+// slot, so fingerprints are never 0.
+static inline uint16_t ck_fingerprint(uint64_t h) {
+	uint16_t fp = h;
+	return fp ? fp : 1;
+}
+
+static inline uint64_t ck_alt_bucket(uint64_t bucket, uint16_t fp) {
+	uint64_t h = ck_reduce(mix64(fp));
+	return h >= bucket ? h - bucket : h + ck_nbuckets - bucket;
+}
+
+static inline int ck_find(uint64_t bucket, uint16_t fp) {
+	for (int s = 0; s < CUCKOO_SLOTS; s++)
+		if (ck_buckets[bucket][s] == fp)
+			return s;
+	return -1;
+}
+
+static inline bool ck_put(uint64_t bucket, uint16_t fp) {
+	int s = ck_find(bucket, 0);
+	if (s < 0)
+		return false;
+	ck_buckets[bucket][s] = fp;
+	return true;
+}
+
+inline int ck_init(uint64_t nbits)
+{
+	uint64_t nslots = (1ULL << nbits);
+	uint64_t nblocks = (nslots + QUQU_SLOTS_PER_BLOCK) / QUQU_SLOTS_PER_BLOCK;
+	ck_nbuckets = nblocks * sizeof(vqf_block) / sizeof(ck_buckets[0]);
+	ck_buckets = (uint16_t (*)[CUCKOO_SLOTS])calloc(ck_nbuckets, sizeof(ck_buckets[0]));
+	ck_stash.used = false;
+	ck_kick_state = 0x9e3779b97f4a7c15ULL;
+	return ck_buckets == NULL;
+}
+
+inline int ck_insert(__uint128_t val)
+{
+	if (ck_stash.used)
+		return 0;
+	uint64_t h = mix64((uint64_t)val);
+	uint16_t fp = ck_fingerprint(h);
+	uint64_t bucket = ck_reduce(h);
+	if (ck_put(bucket, fp))
+		return 1;
+	bucket = ck_alt_bucket(bucket, fp);
+	if (ck_put(bucket, fp))
+		return 1;
+	for (int kick = 0; kick < CUCKOO_MAX_KICKS; kick++) {
+		ck_kick_state = mix64(ck_kick_state);
+		int s = ck_kick_state % CUCKOO_SLOTS;
+		uint16_t victim = ck_buckets[bucket][s];
+		ck_buckets[bucket][s] = fp;
+		fp = victim;
+		bucket = ck_alt_bucket(bucket, fp);
+		if (ck_put(bucket, fp))
+			return 1;
+	}
+	ck_stash.used = true;
+	ck_stash.bucket = bucket;
+	ck_stash.fp = fp;
+	return 1;
+}
+
+inline int ck_lookup(__uint128_t val)
+{
+	uint64_t h = mix64((uint64_t)val);
+	uint16_t fp = ck_fingerprint(h);
+	uint64_t bucket = ck_reduce(h), alt = ck_alt_bucket(bucket, fp);
+	if (ck_find(bucket, fp) >= 0 || ck_find(alt, fp) >= 0)
+		return 1;
+	return ck_stash.used && ck_stash.fp == fp &&
+		(ck_stash.bucket == bucket || ck_stash.bucket == alt);
+}
+
+inline int ck_remove(__uint128_t val)
+{
+	uint64_t h = mix64((uint64_t)val);
+	uint16_t fp = ck_fingerprint(h);
+	uint64_t bucket = ck_reduce(h);
+	int s = ck_find(bucket, fp);
+	if (s < 0) {
+		bucket = ck_alt_bucket(bucket, fp);
+		s = ck_find(bucket, fp);
+	}
+	if (s >= 0) {
+		ck_buckets[bucket][s] = 0;
+	} else if (ck_stash.used && ck_stash.fp == fp) {
+		ck_stash.used = false;
+		return 1;
+	} else {
+		return 0;
+	}
+	// the freed slot may take the stashed fingerprint
+	if (ck_stash.used && (ck_put(ck_stash.bucket, ck_stash.fp) ||
+				ck_put(ck_alt_bucket(ck_stash.bucket, ck_stash.fp), ck_stash.fp)))
+		ck_stash.used = false;
+	return 1;
+}
+
+// 1 if val's fingerprint is only in its second bucket
+inline int ck_alt_lookup(__uint128_t val)
+{
+	uint64_t h = mix64((uint64_t)val);
+	uint16_t fp = ck_fingerprint(h);
+	uint64_t bucket = ck_reduce(h), alt = ck_alt_bucket(bucket, fp);
+	return alt != bucket && ck_find(bucket, fp) < 0 && ck_find(alt, fp) >= 0;
+}
+
+inline __uint128_t ck_range()
+{
+	return UINT64_MAX;
+}
+
+inline uint64_t ck_bytes()
+{
+	return ck_nbuckets * sizeof(ck_buckets[0]);
+}
+
+inline int ck_destroy()
+{
+	free(ck_buckets);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  latency_histogram.h
+ *
+ *    Description:  Low-overhead latency histograms for the benchmark drivers.
+ *                  Latencies are TSC cycles read with rdtscp around sampled
+ *                  operations, kept in HDR-style log-linear buckets: each
+ *                  power of two is split into 2^LATENCY_SUB_BITS buckets, so a
+ *                  recorded value is within 1/32 of the truth at any scale
+ *                  and recording is a count increment.
+ *
+ * ============================================================================
+ */
+
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <x86intrin.h>
+
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_BUCKETS (1ULL << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((65 - LATENCY_SUB_BITS) * LATENCY_SUB_BUCKETS)
+
+// Operations timed by default: one in LATENCY_SAMPLE_PERIOD (a power of two).
+#define LATENCY_SAMPLE_PERIOD 16
+
+typedef struct latency_histogram {
+   uint64_t count;
+   uint64_t max;
+   uint64_t counts[LATENCY_BUCKETS];
+} latency_histogram;
+
+static inline uint64_t latency_now(void) {
+   unsigned aux;
+   return __rdtscp(&aux);
+}
+
+// True for the operations to time when sampling one in (mask + 1).
+static inline bool latency_sampled(uint64_t i, uint64_t mask) {
+   return (i & mask) == 0;
+}
+
+static inline void latency_reset(latency_histogram *h) {
+   memset(h, 0, sizeof(*h));
+}
+
+// Values below 2^LATENCY_SUB_BITS have a bucket each; above, the bucket is
+// the position of the top bit and the LATENCY_SUB_BITS bits below it.
+static inline uint64_t latency_bucket(uint64_t cycles) {
+   if (cycles < LATENCY_SUB_BUCKETS)
+      return cycles;
+   uint64_t shift = 63 - __builtin_clzll(cycles) - LATENCY_SUB_BITS;
+   return ((shift + 1) << LATENCY_SUB_BITS) + ((cycles >> shift) - LATENCY_SUB_BUCKETS);
+}
+
+// The midpoint of the values that fall in bucket.
+static inline double latency_bucket_value(uint64_t bucket) {
+   if (bucket < LATENCY_SUB_BUCKETS)
+      return bucket;
+   uint64_t shift = (bucket >> LATENCY_SUB_BITS) - 1;
+   uint64_t low = ((bucket & (LATENCY_SUB_BUCKETS - 1)) + LATENCY_SUB_BUCKETS) << shift;
+   return low + ((1ULL << shift) - 1) / 2.0;
+}
+
+static inline void latency_record(latency_histogram *h, uint64_t cycles) {
+   h->counts[latency_bucket(cycles)]++;
+   h->count++;
+   if (cycles > h->max)
+      h->max = cycles;
+}
+
+static inline void latency_merge(latency_histogram *into, const latency_histogram *from) {
+   for (uint64_t i = 0; i < LATENCY_BUCKETS; i++)
+      into->counts[i] += from->counts[i];
+   into->count += from->count;
+   if (from->max > into->max)
+      into->max = from->max;
+}
+
+// The latency in cycles that a fraction q of the recorded operations do not
+// exceed.
+static inline double latency_percentile(const latency_histogram *h, double q) {
+   if (h->count == 0)
+      return 0;
+   uint64_t rank = q * (h->count - 1), seen = 0;
+   for (uint64_t i = 0; i < LATENCY_BUCKETS; i++) {
+      seen += h->counts[i];
+      if (seen > rank)
+         return latency_bucket_value(i) < h->max ? latency_bucket_value(i) : h->max;
+   }
+   return h->max;
+}
+
+// Nanoseconds per TSC cycle, measured once against CLOCK_MONOTONIC over 20ms.
+static inline double latency_nsec_per_cycle(void) {
+   static double nsec_per_cycle = 0;
+   if (nsec_per_cycle == 0) {
+      struct timespec start, now;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      uint64_t start_cycles = latency_now(), elapsed;
+      do {
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         elapsed = 1000000000ULL * (now.tv_sec - start.tv_sec) + now.tv_nsec - start.tv_nsec;
+      } while (elapsed < 20000000);
+      nsec_per_cycle = 1.0 * elapsed / (latency_now() - start_cycles);
+   }
+   return nsec_per_cycle;
+}
+
+static inline void latency_print_header(FILE *fp, const char *title) {
+   fprintf(fp, "%-20s %10s %8s %8s %8s %8s %10s\n", title, "samples", "p50", "p90",
+         "p99", "p99.9", "max");
+}
+
+// One row of percentiles in nanoseconds; rows with no samples are skipped.
+static inline void latency_print(FILE *fp, const char *name, const latency_histogram *h) {
+   if (h->count == 0)
+      return;
+   double scale = latency_nsec_per_cycle();
+   fprintf(fp, "%-20s %10lu %8.0f %8.0f %8.0f %8.0f %10.0f\n", name, h->count,
+         latency_percentile(h, 0.5) * scale, latency_percentile(h, 0.9) * scale,
+         latency_percentile(h, 0.99) * scale, latency_percentile(h, 0.999) * scale,
+         h->max * scale);
+}
+
+#endif	// _LATENCY_HISTOGRAM_H_
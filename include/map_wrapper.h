@@ -0,0 +1,98 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  map_wrapper.h
+ *
+ *    Description:  Exact baseline for bm: a std::unordered_map from key to
+ *                  multiplicity, so repeated keys behave as in the VQF. Its
+ *                  space is the bytes its allocator hands out (nodes and the
+ *                  bucket array), not counting malloc's own overhead.
+ *
+ * ============================================================================
+ */
+
+#ifndef MAP_WRAPPER_H
+#define MAP_WRAPPER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <new>
+#include <unordered_map>
+
+#include "zipf.h"
+
+uint64_t um_allocated;
+
+template <typename T>
+struct counting_allocator {
+	typedef T value_type;
+	counting_allocator() = default;
+	template <typename U> counting_allocator(const counting_allocator<U>&) {}
+	T *allocate(size_t n) {
+		um_allocated += n * sizeof(T);
+		return static_cast<T *>(::operator new(n * sizeof(T)));
+	}
+	void deallocate(T *p, size_t n) {
+		um_allocated -= n * sizeof(T);
+		::operator delete(p);
+	}
+};
+template <typename T, typename U>
+bool operator==(const counting_allocator<T>&, const counting_allocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const counting_allocator<T>&, const counting_allocator<U>&) { return false; }
+
+struct um_hash {
+	size_t operator()(uint64_t key) const { return mix64(key); }
+};
+
+typedef std::unordered_map<uint64_t, uint32_t, um_hash, std::equal_to<uint64_t>,
+		counting_allocator<std::pair<const uint64_t, uint32_t>>> um_map;
+
+um_map *um_keys;
+
+inline int um_init(uint64_t nbits)
+{
+	um_keys = new um_map();
+	return 0;
+}
+
+inline int um_insert(__uint128_t val)
+{
+	(*um_keys)[(uint64_t)val]++;
+	return 1;
+}
+
+inline int um_lookup(__uint128_t val)
+{
+	return um_keys->find((uint64_t)val) != um_keys->end();
+}
+
+inline int um_remove(__uint128_t val)
+{
+	um_map::iterator it = um_keys->find((uint64_t)val);
+	if (it == um_keys->end())
+		return 0;
+	if (--it->second == 0)
+		um_keys->erase(it);
+	return 1;
+}
+
+inline __uint128_t um_range()
+{
+	return UINT64_MAX;
+}
+
+inline uint64_t um_bytes()
+{
+	return um_allocated;
+}
+
+inline int um_destroy()
+{
+	delete um_keys;
+	return 0;
+}
+
+#endif
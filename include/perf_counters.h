@@ -0,0 +1,142 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  perf_counters.h
+ *
+ *    Description:  Hardware performance counters for the benchmark drivers,
+ *                  read through perf_event_open around each timed phase.
+ *                  Only user-space events of this process (and the threads
+ *                  it starts after the counters are opened) are counted, so
+ *                  perf_event_paranoid up to 2 is enough. Events that cannot
+ *                  be opened, because perf is not permitted or the PMU is not
+ *                  exposed, are left out of the report.
+ *
+ * ============================================================================
+ */
+
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+enum perf_counter_event {
+   PERF_CYCLES,
+   PERF_INSTRUCTIONS,
+   PERF_CACHE_MISSES,
+   PERF_DTLB_MISSES,
+   PERF_BRANCH_MISSES,
+   PERF_NUM_EVENTS
+};
+
+typedef struct perf_counters {
+   int fds[PERF_NUM_EVENTS];
+   // counts of the last phase, scaled up if the kernel multiplexed the event
+   double values[PERF_NUM_EVENTS];
+} perf_counters;
+
+static inline int perf_counter_open(uint32_t type, uint64_t config) {
+   struct perf_event_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = type;
+   attr.config = config;
+   attr.disabled = 1;
+   attr.inherit = 1;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+   return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Opens every event that is available. Returns false, after saying why on
+// stderr, if none is.
+static inline bool perf_counters_open(perf_counters *pc) {
+   static const uint32_t types[PERF_NUM_EVENTS] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+      PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+   };
+   static const uint64_t configs[PERF_NUM_EVENTS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_BRANCH_MISSES
+   };
+   bool any = false;
+   int err = 0;
+
+   for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+      pc->fds[i] = perf_counter_open(types[i], configs[i]);
+      pc->values[i] = 0;
+      if (pc->fds[i] >= 0)
+         any = true;
+      else
+         err = errno;
+   }
+   if (!any)
+      fprintf(stderr, "Hardware counters unavailable (%s); reporting time only.\n",
+            strerror(err));
+   return any;
+}
+
+static inline void perf_counters_close(perf_counters *pc) {
+   for (int i = 0; i < PERF_NUM_EVENTS; i++)
+      if (pc->fds[i] >= 0)
+         close(pc->fds[i]);
+}
+
+static inline void perf_counters_start(perf_counters *pc) {
+   for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+      if (pc->fds[i] >= 0) {
+         ioctl(pc->fds[i], PERF_EVENT_IOC_RESET, 0);
+         ioctl(pc->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+   }
+}
+
+static inline void perf_counters_stop(perf_counters *pc) {
+   for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+      if (pc->fds[i] >= 0)
+         ioctl(pc->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+   }
+   for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+      uint64_t data[3];   // value, time enabled, time running
+      pc->values[i] = -1;
+      if (pc->fds[i] >= 0 && read(pc->fds[i], data, sizeof(data)) == sizeof(data) &&
+            data[2] > 0)
+         pc->values[i] = data[1] > data[2] ? 1.0 * data[0] * data[1] / data[2] : data[0];
+   }
+}
+
+// One line of per-operation counts for the last phase; missing events are
+// shown as "-".
+static inline void perf_counters_print(FILE *fp, const perf_counters *pc, const char *name,
+      uint64_t nops) {
+   static const char *names[PERF_NUM_EVENTS] = {
+      "cycles", "instructions", "cache misses", "dTLB misses", "branch misses"
+   };
+   bool any = false;
+   for (int i = 0; i < PERF_NUM_EVENTS; i++)
+      any |= pc->values[i] >= 0 && pc->fds[i] >= 0;
+   if (!any || nops == 0)
+      return;
+
+   fprintf(fp, "%s per op:", name);
+   for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+      if (pc->fds[i] >= 0 && pc->values[i] >= 0)
+         fprintf(fp, " %s %.3f", names[i], pc->values[i] / nops);
+      else
+         fprintf(fp, " %s -", names[i]);
+   }
+   if (pc->values[PERF_CYCLES] > 0 && pc->values[PERF_INSTRUCTIONS] >= 0)
+      fprintf(fp, " (IPC %.2f)", pc->values[PERF_INSTRUCTIONS] / pc->values[PERF_CYCLES]);
+   fprintf(fp, "\n");
+}
+
+#endif	// _PERF_COUNTERS_H_
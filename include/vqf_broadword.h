@@ -0,0 +1,121 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  vqf_broadword.h
+ *
+ *    Description:  Select and metadata shifts without pdep/pext. On AMD Zen 1
+ *                  and Zen 2 those instructions are microcoded and take tens
+ *                  to hundreds of cycles, so the filter switches to these
+ *                  versions at runtime (see cpu_features).
+ *
+ * ============================================================================
+ */
+
+#ifndef _VQF_BROADWORD_H_
+#define _VQF_BROADWORD_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace vqf {
+
+#define ONES_STEP_8 0x0101010101010101ULL
+#define MSBS_STEP_8 0x8080808080808080ULL
+
+// pos[rank][byte] is the position of the rank'th 1 in byte, 8 if none.
+struct select_in_byte_table {
+   uint8_t pos[8][256];
+};
+
+constexpr select_in_byte_table make_select_in_byte_table() {
+   select_in_byte_table t = {};
+   for (unsigned rank = 0; rank < 8; rank++) {
+      for (unsigned byte = 0; byte < 256; byte++) {
+         unsigned seen = 0, pos = 8;
+         for (unsigned bit = 0; bit < 8 && pos == 8; bit++) {
+            if ((byte >> bit) & 1) {
+               if (seen == rank)
+                  pos = bit;
+               seen++;
+            }
+         }
+         t.pos[rank][byte] = pos;
+      }
+   }
+   return t;
+}
+
+template <typename Unused = void>
+struct select_in_byte {
+   alignas(64) static constexpr select_in_byte_table table = make_select_in_byte_table();
+};
+
+template <typename Unused>
+constexpr select_in_byte_table select_in_byte<Unused>::table;
+
+// Returns the position of the rank'th 1.  (rank = 0 returns the 1st 1)
+// Returns 64 if there are fewer than rank+1 1s.
+// Vigna, "Broadword implementation of rank/select queries", 2008: the byte
+// holding the answer is found from per-byte prefix popcounts, the bit within
+// it from a table.
+static inline uint64_t word_select_broadword(uint64_t val, uint64_t rank) {
+   if (rank >= (uint64_t)__builtin_popcountll(val))
+      return 64;
+
+   uint64_t s = val - ((val >> 1) & 0x5555555555555555ULL);
+   s = (s & 0x3333333333333333ULL) + ((s >> 2) & 0x3333333333333333ULL);
+   s = (s + (s >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+   uint64_t byte_sums = s * ONES_STEP_8;
+
+   // 8 * number of bytes whose inclusive prefix popcount is <= rank
+   uint64_t rank_step_8 = rank * ONES_STEP_8;
+   uint64_t byte_offset = (((((rank_step_8 | MSBS_STEP_8) - byte_sums) & MSBS_STEP_8) >> 7)
+         * ONES_STEP_8 >> 53) & ~0x7ULL;
+   uint64_t byte_rank = rank - (((byte_sums << 8) >> byte_offset) & 0xff);
+
+   return byte_offset + select_in_byte<>::table.pos[byte_rank][(val >> byte_offset) & 0xff];
+}
+
+// Same result as _pdep_u64(1ULL << rank, vector): the rank'th 1 of vector
+// isolated, or 0 if there is none.
+static inline uint64_t deposit_one_broadword(uint64_t vector, uint64_t rank) {
+   uint64_t pos = word_select_broadword(vector, rank);
+   return pos < 64 ? 1ULL << pos : 0;
+}
+
+// Same result as _pdep_u64(md, ~(1ULL << index)) for index < 64: a 0 is
+// opened at index and the bits above move up by one.
+static inline uint64_t insert_zero_broadword(uint64_t md, uint64_t index) {
+   uint64_t low = (1ULL << index) - 1;
+   return (md & low) | ((md << 1) & ~((2ULL << index) - 1));
+}
+
+// Same result as _pext_u64(md, ~(1ULL << index)) for index < 64: bit index
+// is dropped and the bits above move down by one.
+static inline uint64_t remove_bit_broadword(uint64_t md, uint64_t index) {
+   uint64_t low = (1ULL << index) - 1;
+   return (md & low) | ((md >> 1) & ~low);
+}
+
+// True when pdep/pext are microcoded: AMD family 17h (Zen, Zen+, Zen 2 and
+// Hygon Dhyana). VQF_SLOW_PDEP=0 or 1 in the environment overrides this.
+static inline bool detect_slow_pdep(void) {
+   const char *env = getenv("VQF_SLOW_PDEP");
+   if (env != NULL)
+      return atoi(env) != 0;
+   __builtin_cpu_init();
+   return __builtin_cpu_is("amdfam17h");
+}
+
+// Set once at startup, shared by every translation unit.
+template <typename Unused = void>
+struct cpu_features {
+   static const bool slow_pdep;
+};
+
+template <typename Unused>
+const bool cpu_features<Unused>::slow_pdep = detect_slow_pdep();
+
+}  // namespace vqf
+
+#endif	// _VQF_BROADWORD_H_
@@ -12,6 +12,7 @@
 #ifndef _VQF_FILTER_H_
 #define _VQF_FILTER_H_
 #include <vector>
+#include <stdio.h>
 #include <inttypes.h>
 #include <stdbool.h>
 
@@ -33,19 +34,45 @@ extern "C" {
 	// We are using 8-bit tags.
 	// One block consists of 28 8-bit slots covering 36 buckets, and 28+36 = 64
 	// bits of metadata. Each tag has an 8-bit value for 8+28+28 = 64
-	typedef struct __attribute__ ((__packed__)) vqf_block {
+	typedef struct __attribute__ ((__packed__)) vqf_interleaved_block {
 		uint64_t md;
-		uint16_t tags[28];
-	} vqf_block;
+		uint16_t tags[28];	// (value << 8) | tag
+	} vqf_interleaved_block;
+
+	// Same slots with the 28 tags stored contiguously ahead of the 28 values,
+	// so a probe compares the tags with one 256-bit byte compare and reads a
+	// value only on a hit. Selected with VQF_SPLIT_BLOCKS.
+	typedef struct __attribute__ ((__packed__)) vqf_split_block {
+		uint64_t md;
+		uint8_t tags[28];
+		uint8_t vals[28];
+	} vqf_split_block;
+
+#ifdef VQF_SPLIT_BLOCKS
+	typedef vqf_split_block vqf_block;
+#else
+	typedef vqf_interleaved_block vqf_block;
+#endif
 #endif
 
+	// Inserts and removes count into one of VQF_COUNT_SHARDS counters, picked
+	// per thread, each on its own cache line so concurrent threads do not
+	// contend on the count. A shard can go negative when a thread removes
+	// keys another inserted; only the sum is meaningful.
+#define VQF_COUNT_SHARDS 16
+
+	typedef struct __attribute__ ((aligned (64))) vqf_count_shard {
+		int64_t count;
+	} vqf_count_shard;
+
 	typedef struct vqf_metadata {
 		uint64_t total_size_in_bytes;
 		uint64_t key_remainder_bits;
 		uint64_t range;
 		uint64_t nblocks;
-		uint64_t nelts;
+		uint64_t nelts;		// not maintained; vqf_size() sums the counts
 		uint64_t nslots;
+		vqf_count_shard counts[VQF_COUNT_SHARDS];
 	} vqf_metadata;
 
 	typedef struct vqf_filter {
@@ -53,6 +80,56 @@ extern "C" {
 		vqf_block blocks[];
 	} vqf_filter;
 
+	// Space and occupancy of a filter, from vqf_get_stats.
+	typedef struct vqf_stats {
+		uint64_t block_bytes;
+		uint64_t nblocks;
+		uint64_t nslots;
+		uint64_t filter_bytes;     // metadata and blocks, as asked of malloc
+		uint64_t allocated_bytes;  // the pages the allocation spans
+		uint64_t page_size;        // the huge page size if THP is always on
+		uint64_t entries;          // tags in the blocks, from the metadata bits
+		uint64_t size;             // vqf_size(), the maintained count
+		double load_factor;        // entries / nslots
+		double bits_per_entry;     // allocated bits / entries
+		double fp_rate;            // estimated from the tag width and occupancy
+	} vqf_stats;
+
+	// Block occupancy, from vqf_get_occupancy. A block has 28 slots: its 64
+	// metadata bits are the 36 bucket ends and one 0 per tag. In a
+	// thread-safe filter the top bit is the block lock, so a block holds up
+	// to 27 tags and is full with 1 slot free.
+#define VQF_OCCUPANCY_BINS 29
+#define VQF_NEAR_FULL_SLOTS 2
+
+	typedef struct vqf_occupancy {
+		uint64_t nblocks;
+		uint64_t entries;
+		uint64_t free_slots[VQF_OCCUPANCY_BINS];   // blocks by free slots
+		uint64_t run_lengths[VQF_OCCUPANCY_BINS];  // buckets by tags in their run
+		uint64_t longest_run;
+		uint64_t full_blocks;
+		uint64_t near_full_blocks;  // at most VQF_NEAR_FULL_SLOTS free beyond full
+		uint64_t alt_blocks;        // full enough that inserts check the alternate
+		double mean_free;
+		double stddev_free;
+	} vqf_occupancy;
+
+	// Hot-path event counts, summed over all threads and filters since the
+	// process started. Counted only in builds with VQF_EVENT_COUNTERS.
+	typedef struct vqf_events {
+		uint64_t inserts;
+		uint64_t insert_alt_checks;  // primary below QUQU_CHECK_ALT free, alternate read
+		uint64_t insert_alt_chosen;  // the alternate block had more room
+		uint64_t insert_failures;    // both blocks full
+		uint64_t lookups;            // is_present, query and query_iter
+		uint64_t lookup_alt_probes;  // lookups that missed the primary block
+		uint64_t removes;
+		uint64_t remove_alt_probes;  // removes that missed the primary block
+		uint64_t match_masks;        // generate_match_mask calls
+		uint64_t matched_tags;       // bits set in the masks they returned
+	} vqf_events;
+
 	vqf_filter * vqf_init(uint64_t nslots);
 
 	bool vqf_insert(vqf_filter * restrict filter, uint64_t hash);
@@ -65,6 +142,41 @@ extern "C" {
     bool vqf_query(vqf_filter * restrict filter, uint64_t hash, uint8_t & value);
     bool vqf_query_iter(vqf_filter * restrict filter, uint64_t hash, std::vector<uint8_t>& values);
 
+	// The number of entries, summed from the shard counters. Cheap enough
+	// to call per request; concurrent updates may or may not be included.
+	uint64_t vqf_size(const vqf_filter * restrict filter);
+
+	double vqf_load_factor(const vqf_filter * restrict filter);
+
+	// Counts the entries exactly from the block metadata with nthreads
+	// threads (0 for one per online CPU), to check vqf_size(). The filter
+	// must not change during the count.
+	uint64_t vqf_count_entries(const vqf_filter * restrict filter, uint32_t nthreads);
+
+	// Scans every block's metadata, so it costs a pass over the filter.
+	void vqf_get_stats(const vqf_filter * restrict filter, vqf_stats *stats);
+
+	void vqf_print_stats(FILE *fp, const vqf_stats *stats);
+
+	// Scans every block's metadata with nthreads threads (0 for one per
+	// online CPU). If heatmap is not NULL, it also splits the blocks into
+	// ncells equal ranges and stores the load of each. The filter should
+	// not change during the scan.
+	void vqf_get_occupancy(const vqf_filter * restrict filter, uint32_t nthreads,
+			vqf_occupancy *occupancy, double *heatmap, uint32_t ncells);
+
+	void vqf_print_occupancy(FILE *fp, const vqf_occupancy *occupancy);
+
+	// Prints the cell loads width to a row, one character per cell.
+	void vqf_print_heatmap(FILE *fp, const double *heatmap, uint32_t ncells, uint32_t width);
+
+	// Sums every thread's event counters without stopping them; a count
+	// may miss the updates racing with it. Returns false, with all counts
+	// 0, if the library was built without VQF_EVENT_COUNTERS.
+	bool vqf_get_events(vqf_events *events);
+
+	void vqf_print_events(FILE *fp, const vqf_events *events);
+
 #ifdef __cplusplus
 
 }
@@ -0,0 +1,923 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  vqf_inline.h
+ *
+ *    Description:  Header-only implementation of the VQF operations. The
+ *                  extern "C" entry points in vqf_filter.c are thin wrappers
+ *                  around these templates; C++ callers can include this
+ *                  header directly so the operations inline into their loops.
+ *
+ *         Author:  Prashant Pandey (), ppandey@berkeley.edu
+ *   Organization:  LBNL/UCB
+ *
+ * ============================================================================
+ */
+
+#ifndef _VQF_INLINE_H_
+#define _VQF_INLINE_H_
+
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <immintrin.h>  // portable to all x86 compilers
+#include <tmmintrin.h>
+
+#include "vqf_filter.h"
+#include "vqf_precompute.h"
+#include "vqf_shuffle.h"
+#include "vqf_broadword.h"
+#include "vqf_probes.h"
+
+// ALT block check is set of 75% of the number of slots
+#if TAG_BITS == 8
+#define TAG_MASK 0xff
+#define QUQU_SLOTS_PER_BLOCK 28
+#define QUQU_BUCKETS_PER_BLOCK 36
+#define QUQU_CHECK_ALT 43
+#endif
+
+
+#define LOCK_MASK (1ULL << 63)
+#define UNLOCK_MASK ~(1ULL << 63)
+
+// Locking mode used by the C API. The lock lives in the top metadata bit, so
+// a filter must be accessed with one mode only.
+#ifdef ENABLE_THREADS
+#define VQF_THREAD_SAFE true
+#else
+#define VQF_THREAD_SAFE false
+#endif
+
+namespace vqf {
+
+// The fields every operation reads. They do not change after vqf_init(), so
+// a loop can build this once and keep them in registers.
+struct view {
+   vqf_block *blocks;
+   uint64_t   key_remainder_bits;
+   uint64_t   range;
+   vqf_count_shard *counts;
+};
+
+static inline view make_view(vqf_filter * restrict filter) {
+   view v = { filter->blocks, filter->metadata.key_remainder_bits,
+      filter->metadata.range, filter->metadata.counts };
+   return v;
+}
+
+// The count shard of the calling thread, assigned round-robin on first use.
+template <typename Unused = void>
+struct count_shard {
+   static uint32_t next;
+   static thread_local int32_t index;
+};
+
+template <typename Unused>
+uint32_t count_shard<Unused>::next;
+
+template <typename Unused>
+thread_local int32_t count_shard<Unused>::index = -1;
+
+// Single-threaded filters keep the whole count in shard 0 with a plain add.
+template <bool kThreadSafe>
+static inline void count_entries(const view& v, int64_t delta)
+{
+   if (kThreadSafe) {
+      int32_t& index = count_shard<>::index;
+      if (__builtin_expect(index < 0, 0))
+         index = __atomic_fetch_add(&count_shard<>::next, 1, __ATOMIC_RELAXED) % VQF_COUNT_SHARDS;
+      __atomic_fetch_add(&v.counts[index].count, delta, __ATOMIC_RELAXED);
+   } else {
+      v.counts[0].count += delta;
+   }
+}
+
+// Contention on the block locks seen by one thread. Only the slow path of
+// lock() counts, so an uncontended acquisition costs nothing extra.
+struct lock_stats {
+   uint64_t contended;  // acquisitions that found the block locked
+   uint64_t retries;    // attempts that lost the race after the lock looked free
+   uint64_t spins;      // reads of a locked block while waiting
+};
+
+template <typename Unused = void>
+struct lock_counters {
+   static thread_local lock_stats stats;
+};
+
+template <typename Unused>
+thread_local lock_stats lock_counters<Unused>::stats;
+
+// The calling thread's counters; reset them by assigning {}.
+static inline lock_stats& thread_lock_stats() {
+   return lock_counters<>::stats;
+}
+
+static inline void lock_contended(uint64_t *data)
+{
+   lock_stats& stats = thread_lock_stats();
+   stats.contended++;
+   for (;;) {
+      while (__atomic_load_n(data, __ATOMIC_RELAXED) & LOCK_MASK) {
+         stats.spins++;
+         _mm_pause();
+      }
+      if ((__sync_fetch_and_or(data, LOCK_MASK) & LOCK_MASK) == 0)
+         return;
+      stats.retries++;
+   }
+}
+
+// Hot-path event counters (vqf_events), compiled in with VQF_EVENT_COUNTERS.
+// Each thread counts into its own cache-line-aligned record, which it pushes
+// onto a list on first use and never frees, so vqf_get_events can walk the
+// list while threads keep counting, and counts outlive their threads. Only
+// the owning thread writes a record; it stores with a relaxed atomic so the
+// reader never sees a torn count.
+#ifdef VQF_EVENT_COUNTERS
+struct __attribute__((aligned(64))) event_record {
+   vqf_events events;
+   event_record *next;
+};
+
+template <typename Unused = void>
+struct event_counters {
+   static event_record *head;
+   static thread_local event_record *local;
+};
+
+template <typename Unused>
+event_record *event_counters<Unused>::head;
+
+template <typename Unused>
+thread_local event_record *event_counters<Unused>::local;
+
+static __attribute__((noinline)) event_record *register_events(void)
+{
+   void *p;
+   if (posix_memalign(&p, 64, sizeof(event_record)) != 0)
+      abort();
+   event_record *r = (event_record *)memset(p, 0, sizeof(event_record));
+   r->next = __atomic_load_n(&event_counters<>::head, __ATOMIC_RELAXED);
+   while (!__atomic_compare_exchange_n(&event_counters<>::head, &r->next, r, true,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+   return event_counters<>::local = r;
+}
+
+static inline vqf_events& thread_events() {
+   event_record *r = event_counters<>::local;
+   if (__builtin_expect(r == NULL, 0))
+      r = register_events();
+   return r->events;
+}
+
+#define VQF_EVENT(field, n) do { \
+   uint64_t *c_ = &vqf::thread_events().field; \
+   __atomic_store_n(c_, *c_ + (n), __ATOMIC_RELAXED); \
+} while (0)
+#else
+#define VQF_EVENT(field, n) do {} while (0)
+#endif
+
+template <bool kThreadSafe>
+static inline void lock(vqf_block& block)
+{
+   if (kThreadSafe) {
+      uint64_t *data = &block.md;
+      if (__builtin_expect((__sync_fetch_and_or(data, LOCK_MASK) & LOCK_MASK) != 0, 0))
+         lock_contended(data);
+   }
+}
+
+template <bool kThreadSafe>
+static inline void unlock(vqf_block& block)
+{
+   if (kThreadSafe) {
+      uint64_t *data = &block.md;
+      __sync_fetch_and_and(data, UNLOCK_MASK);
+   }
+}
+
+template <bool kThreadSafe>
+static inline void lock_blocks(const view& v, uint64_t index1, uint64_t index2)  {
+   if (index1 < index2) {
+      lock<kThreadSafe>(v.blocks[index1/QUQU_BUCKETS_PER_BLOCK]);
+      lock<kThreadSafe>(v.blocks[index2/QUQU_BUCKETS_PER_BLOCK]);
+   } else {
+      lock<kThreadSafe>(v.blocks[index2/QUQU_BUCKETS_PER_BLOCK]);
+      lock<kThreadSafe>(v.blocks[index1/QUQU_BUCKETS_PER_BLOCK]);
+   }
+}
+
+template <bool kThreadSafe>
+static inline void unlock_blocks(const view& v, uint64_t index1, uint64_t index2)  {
+   if (index1 < index2) {
+      unlock<kThreadSafe>(v.blocks[index1/QUQU_BUCKETS_PER_BLOCK]);
+      unlock<kThreadSafe>(v.blocks[index2/QUQU_BUCKETS_PER_BLOCK]);
+   } else {
+      unlock<kThreadSafe>(v.blocks[index2/QUQU_BUCKETS_PER_BLOCK]);
+      unlock<kThreadSafe>(v.blocks[index1/QUQU_BUCKETS_PER_BLOCK]);
+   }
+}
+
+static inline int word_rank(uint64_t val) {
+   return __builtin_popcountll(val);
+}
+
+// Returns the position of the rank'th 1.  (rank = 0 returns the 1st 1)
+// Returns 64 if there are fewer than rank+1 1s.
+static inline uint64_t word_select_pdep(uint64_t val, int rank) {
+   val = _pdep_u64(one[rank], val);
+   return _tzcnt_u64(val);
+}
+
+// The pdep/pext primitives below fall back to the broadword versions in
+// vqf_broadword.h on CPUs where pdep is slow.
+static inline uint64_t word_select(uint64_t val, int rank) {
+   if (cpu_features<>::slow_pdep)
+      return word_select_broadword(val, rank);
+   return word_select_pdep(val, rank);
+}
+
+// select(vec, 0) -> -1
+// select(vec, i) -> 128, if i > popcnt(vec)
+static inline int64_t select_128_old(__uint128_t vector, uint64_t rank) {
+   uint64_t lower_word = vector & 0xffffffffffffffff;
+   uint64_t lower_pdep = _pdep_u64(one[rank], lower_word);
+   //uint64_t lower_select = word_select(lower_word, rank);
+   if (lower_pdep != 0) {
+      //assert(rank < word_rank(lower_word));
+      return _tzcnt_u64(lower_pdep);
+   }
+   rank = rank - word_rank(lower_word);
+   uint64_t higher_word = vector >> 64;
+   return word_select(higher_word, rank) + 64;
+}
+
+static inline uint64_t lookup_64_pdep(uint64_t vector, uint64_t rank) {
+   uint64_t lower_return = _pdep_u64(one[rank], vector) >> rank << (sizeof(uint64_t)/2);
+   return lower_return;
+}
+
+static inline uint64_t lookup_64_broadword(uint64_t vector, uint64_t rank) {
+   return deposit_one_broadword(vector, rank) >> rank << (sizeof(uint64_t)/2);
+}
+
+static inline uint64_t lookup_64(uint64_t vector, uint64_t rank) {
+   if (cpu_features<>::slow_pdep)
+      return lookup_64_broadword(vector, rank);
+   return lookup_64_pdep(vector, rank);
+}
+
+static inline uint64_t lookup_128(uint64_t *vector, uint64_t rank) {
+   uint64_t lower_word = vector[0];
+   uint64_t lower_rank = word_rank(lower_word);
+   uint64_t lower_return = _pdep_u64(one[rank], lower_word) >> rank << sizeof(__uint128_t);
+   int64_t higher_rank = (int64_t)rank - lower_rank;
+   uint64_t higher_word = vector[1];
+   uint64_t higher_return = _pdep_u64(one[higher_rank], higher_word);
+   higher_return <<= (64 + sizeof(__uint128_t) - rank);
+   return lower_return + higher_return;
+}
+
+static inline int64_t select_64(uint64_t vector, uint64_t rank) {
+   return _tzcnt_u64(lookup_64(vector, rank));
+}
+
+static inline int64_t select_128(uint64_t *vector, uint64_t rank) {
+   return _tzcnt_u64(lookup_128(vector, rank));
+}
+
+// Tag shift kernels. index is the slot where a slot is opened or closed,
+// counted in 16-bit lanes of the interleaved block, i.e. after the 4 lanes of
+// metadata; the split-layout kernels take the same index. Every kernel the
+// target ISA supports is compiled; update_tags_512/remove_tags_512 pick one.
+#if TAG_BITS == 8
+static_assert(sizeof(vqf_interleaved_block) == 64, "a block must fill one 512-bit vector");
+static_assert(sizeof(vqf_split_block) == 64, "a block must fill one 512-bit vector");
+
+#ifdef __AVX512BW__
+// A block is one 512-bit vector of 16-bit lanes: 4 lanes of metadata followed
+// by the 28 (value, tag) slots.
+typedef shuffle<uint16_t> block_shuffle;
+static_assert(shuffle_table<uint16_t>::kLanes == QUQU_SLOTS_PER_BLOCK + sizeof(uint64_t)/2,
+      "shuffle lanes must cover the metadata and all slots");
+
+static inline void update_tags_512_permute(vqf_interleaved_block * restrict block, uint8_t index, uint16_t tag) {
+   block->tags[27] = tag;	// add tag at the end
+
+   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
+   __m512i shuffle = _mm512_load_si512(block_shuffle::table.insert[index]);
+   vector = _mm512_permutexvar_epi16(shuffle, vector);
+   _mm512_storeu_si512(reinterpret_cast<__m512i*>(block), vector);
+}
+
+static inline void remove_tags_512_permute(vqf_interleaved_block * restrict block, uint8_t index) {
+   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
+   __m512i shuffle = _mm512_load_si512(block_shuffle::table.remove[index]);
+   vector = _mm512_permutexvar_epi16(shuffle, vector);
+   _mm512_storeu_si512(reinterpret_cast<__m512i*>(block), vector);
+}
+#endif
+
+#ifdef __AVX512VBMI2__
+// Table-free shifts. vpexpandw spreads the lanes over every position but
+// index, which takes the tag from the broadcast source. vpcompressw packs every
+// lane but index down, and the last lane keeps its old value.
+static inline void update_tags_512_expand(vqf_interleaved_block * restrict block, uint8_t index, uint16_t tag) {
+   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
+   vector = _mm512_mask_expand_epi16(_mm512_set1_epi16(tag), ~(1U << index), vector);
+   _mm512_storeu_si512(reinterpret_cast<__m512i*>(block), vector);
+}
+
+static inline void remove_tags_512_expand(vqf_interleaved_block * restrict block, uint8_t index) {
+   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
+   vector = _mm512_mask_compress_epi16(vector, ~(1U << index), vector);
+   _mm512_storeu_si512(reinterpret_cast<__m512i*>(block), vector);
+}
+#endif
+
+static inline void update_tags_scalar(vqf_interleaved_block * restrict block, uint8_t index, uint16_t tag) {
+   index -= 4;
+   memmove(&block->tags[index + 1], &block->tags[index], (sizeof(block->tags) / sizeof(block->tags[0]) - index - 1) * 2);
+   block->tags[index] = tag;
+}
+
+static inline void remove_tags_scalar(vqf_interleaved_block * restrict block, uint8_t index) {
+   index -= 4;
+   memmove(&block->tags[index], &block->tags[index+1], (sizeof(block->tags) / sizeof(block->tags[0]) - index - 1) * 2);
+}
+
+// Split layout: the tag run and the value run each move by one byte.
+static inline void update_tags_split_scalar(vqf_split_block * restrict block, uint8_t index, uint16_t tag) {
+   index -= 4;
+   memmove(&block->tags[index + 1], &block->tags[index], sizeof(block->tags) - index - 1);
+   memmove(&block->vals[index + 1], &block->vals[index], sizeof(block->vals) - index - 1);
+   block->tags[index] = tag & TAG_MASK;
+   block->vals[index] = tag >> 8;
+}
+
+static inline void remove_tags_split_scalar(vqf_split_block * restrict block, uint8_t index) {
+   index -= 4;
+   memmove(&block->tags[index], &block->tags[index + 1], sizeof(block->tags) - index - 1);
+   memmove(&block->vals[index], &block->vals[index + 1], sizeof(block->vals) - index - 1);
+}
+
+#ifdef __AVX512VBMI__
+// Both runs move in one vector: every byte takes its neighbour through a fixed
+// vpermb (the index-0 entries of the 8-bit shuffle table), and a mask covering
+// the moved part of each run picks which bytes keep the shifted value.
+#define SPLIT_TAGS_LANE 8
+#define SPLIT_VALS_LANE (SPLIT_TAGS_LANE + QUQU_SLOTS_PER_BLOCK)
+
+static inline void update_tags_split_512(vqf_split_block * restrict block, uint8_t index, uint16_t tag) {
+   uint64_t slot = index - sizeof(uint64_t)/2;
+   __mmask64 tags_moved = ((1ULL << SPLIT_VALS_LANE) - 1) & ~((1ULL << (SPLIT_TAGS_LANE + slot)) - 1);
+   __mmask64 vals_moved = ~((1ULL << (SPLIT_VALS_LANE + slot)) - 1);
+
+   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
+   __m512i up = _mm512_load_si512(shuffle<uint8_t>::table.insert[0]);
+   vector = _mm512_mask_permutexvar_epi8(vector, tags_moved | vals_moved, up, vector);
+   vector = _mm512_mask_set1_epi8(vector, 1ULL << (SPLIT_TAGS_LANE + slot), tag & TAG_MASK);
+   vector = _mm512_mask_set1_epi8(vector, 1ULL << (SPLIT_VALS_LANE + slot), tag >> 8);
+   _mm512_storeu_si512(reinterpret_cast<__m512i*>(block), vector);
+}
+
+static inline void remove_tags_split_512(vqf_split_block * restrict block, uint8_t index) {
+   uint64_t slot = index - sizeof(uint64_t)/2;
+   __mmask64 tags_moved = ((1ULL << (SPLIT_VALS_LANE - 1)) - 1) & ~((1ULL << (SPLIT_TAGS_LANE + slot)) - 1);
+   __mmask64 vals_moved = ((1ULL << 63) - 1) & ~((1ULL << (SPLIT_VALS_LANE + slot)) - 1);
+
+   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
+   __m512i down = _mm512_load_si512(shuffle<uint8_t>::table.remove[0]);
+   vector = _mm512_mask_permutexvar_epi8(vector, tags_moved | vals_moved, down, vector);
+   _mm512_storeu_si512(reinterpret_cast<__m512i*>(block), vector);
+}
+#endif
+
+// VQF_NO_VBMI2 keeps the permute-table kernel on CPUs that have VBMI2.
+#ifdef VQF_SPLIT_BLOCKS
+#if defined(VQF_USE_AVX) && defined(__AVX512VBMI__)
+#define VQF_TAG_SHIFT_KERNEL "split-vbmi"
+static inline void update_tags_512(vqf_block * restrict block, uint8_t index, uint16_t tag) {
+   update_tags_split_512(block, index, tag);
+}
+
+static inline void remove_tags_512(vqf_block * restrict block, uint8_t index) {
+   remove_tags_split_512(block, index);
+}
+#else
+#define VQF_TAG_SHIFT_KERNEL "split-scalar"
+static inline void update_tags_512(vqf_block * restrict block, uint8_t index, uint16_t tag) {
+   update_tags_split_scalar(block, index, tag);
+}
+
+static inline void remove_tags_512(vqf_block * restrict block, uint8_t index) {
+   remove_tags_split_scalar(block, index);
+}
+#endif
+#elif defined(VQF_USE_AVX)
+#if defined(__AVX512VBMI2__) && !defined(VQF_NO_VBMI2)
+#define VQF_TAG_SHIFT_KERNEL "avx512-vbmi2"
+static inline void update_tags_512(vqf_block * restrict block, uint8_t index, uint16_t tag) {
+   update_tags_512_expand(block, index, tag);
+}
+
+static inline void remove_tags_512(vqf_block * restrict block, uint8_t index) {
+   remove_tags_512_expand(block, index);
+}
+#else
+#define VQF_TAG_SHIFT_KERNEL "avx512-permute"
+static inline void update_tags_512(vqf_block * restrict block, uint8_t index, uint16_t tag) {
+   update_tags_512_permute(block, index, tag);
+}
+
+static inline void remove_tags_512(vqf_block * restrict block, uint8_t index) {
+   remove_tags_512_permute(block, index);
+}
+#endif
+#else
+#define VQF_TAG_SHIFT_KERNEL "scalar"
+static inline void update_tags_512(vqf_block * restrict block, uint8_t index, uint16_t tag) {
+   update_tags_scalar(block, index, tag);
+}
+
+static inline void remove_tags_512(vqf_block * restrict block, uint8_t index) {
+   remove_tags_scalar(block, index);
+}
+#endif
+#endif
+
+#if 0
+// Shuffle using AVX2 vector instruction. It turns out memmove is faster compared to AVX2.
+inline __m256i cross_lane_shuffle(const __m256i & value, const __m256i &
+      shuffle) 
+{ 
+   return _mm256_or_si256(_mm256_shuffle_epi8(value, _mm256_add_epi8(shuffle,
+               K[0])), 
+         _mm256_shuffle_epi8(_mm256_permute4x64_epi64(value, 0x4E),
+            _mm256_add_epi8(shuffle, K[1]))); 
+} 
+
+#define SHUFFLE_SIZE 32
+void shuffle_256(uint8_t * restrict source, __m256i shuffle) {
+   __m256i vector = _mm256_loadu_si256(reinterpret_cast<__m256i*>(source)); 
+
+   vector = cross_lane_shuffle(vector, shuffle); 
+   _mm256_storeu_si256(reinterpret_cast<__m256i*>(source), vector); 
+} 
+
+static inline void update_tags_256(uint8_t * restrict block, uint8_t index,
+      uint8_t tag) {
+   index = index + sizeof(__uint128_t);	// offset index based on md field.
+   block[63] = tag;	// add tag at the end
+   shuffle_256(block + SHUFFLE_SIZE, RM[index]); // right block shuffle
+   if (index < SHUFFLE_SIZE) {		// if index lies in the left block
+      std::swap(block[31], block[32]);	// move tag to the end of left block
+      shuffle_256(block, LM[index]);	// shuffle left block
+   }
+}
+#endif
+
+#if TAG_BITS == 8
+static inline void update_md_pdep(uint64_t *md, uint8_t index) {
+   *md = _pdep_u64(*md, low_order_pdep_table[index]);
+}
+
+static inline void remove_md_pdep(uint64_t *md, uint8_t index) {
+   *md = _pext_u64(*md, low_order_pdep_table[index]) | (1ULL << 63);
+}
+
+static inline void update_md_broadword(uint64_t *md, uint8_t index) {
+   *md = insert_zero_broadword(*md, index);
+}
+
+static inline void remove_md_broadword(uint64_t *md, uint8_t index) {
+   *md = remove_bit_broadword(*md, index) | (1ULL << 63);
+}
+
+static inline void update_md(uint64_t *md, uint8_t index) {
+   if (cpu_features<>::slow_pdep)
+      update_md_broadword(md, index);
+   else
+      update_md_pdep(md, index);
+}
+
+static inline void remove_md(uint64_t *md, uint8_t index) {
+   if (cpu_features<>::slow_pdep)
+      remove_md_broadword(md, index);
+   else
+      remove_md_pdep(md, index);
+}
+
+// number of 0s in the metadata is the number of tags.
+static inline uint64_t get_block_free_space(uint64_t vector) {
+   return word_rank(vector);
+}
+
+// Tags in a block: the 0s in the 63 metadata bits below bit 63. Bit 63 is
+// the lock of a thread-safe block, and otherwise becomes the last bucket end
+// once the block holds QUQU_SLOTS_PER_BLOCK tags, so it is never a tag.
+static inline uint64_t block_tags(uint64_t md) {
+   return 63 - get_block_free_space(md & UNLOCK_MASK);
+}
+
+// Free slots out of QUQU_SLOTS_PER_BLOCK, in either locking mode.
+static inline uint64_t block_free_slots(uint64_t md) {
+   return QUQU_SLOTS_PER_BLOCK - block_tags(md);
+}
+
+// Free slots left in a full block. A thread-safe block cannot take the tag
+// that would push its last bucket end into the lock bit.
+#define QUQU_FULL_FREE_SLOTS(thread_safe) ((thread_safe) ? 1 : 0)
+#endif
+
+// Portable tag compares: bit i of the result is set if the tag byte of
+// tags[i] equals tag, whatever bucket the slot belongs to.
+static inline uint32_t tag_match_mask_loop(const vqf_interleaved_block * restrict block, uint64_t tag) {
+   uint32_t result = 0;
+
+   for (int i=0; i <  QUQU_SLOTS_PER_BLOCK; i++){
+
+      if ((block->tags[i] & TAG_MASK) == tag){
+
+         uint32_t mask = (1UL << i);
+
+         result = result | mask;
+      }
+
+   }
+   return result;
+}
+
+static inline uint32_t tag_match_mask_split_loop(const vqf_split_block * restrict block, uint64_t tag) {
+   uint32_t result = 0;
+
+   for (int i = 0; i < QUQU_SLOTS_PER_BLOCK; i++)
+      if (block->tags[i] == tag)
+         result |= 1UL << i;
+   return result;
+}
+
+// Compares 4 slots per 64-bit word. After xor-ing with the broadcast tag and
+// masking off the values, a matching lane is 0 and every other lane is at
+// most 0xff, so adding 0x7fff sets a lane's top bit exactly when it does not
+// match, with no carry into the next lane. The multiply gathers the four top
+// bits into one nibble.
+static inline uint32_t tag_match_mask_swar(const vqf_interleaved_block * restrict block, uint64_t tag) {
+   const uint64_t bcast = tag * 0x0001000100010001ULL;
+   uint32_t result = 0;
+
+   for (int i = 0; i < QUQU_SLOTS_PER_BLOCK / 4; i++) {
+      uint64_t word;
+      memcpy(&word, &block->tags[4 * i], sizeof(word));
+
+      uint64_t x = (word ^ bcast) & 0x00ff00ff00ff00ffULL;
+      uint64_t zero = ~(x + 0x7fff7fff7fff7fffULL) & 0x8000800080008000ULL;
+      result |= (uint32_t)(((zero >> 15) * 0x0001000200040008ULL) >> 48) << (4 * i);
+   }
+   return result;
+}
+
+// Split layout: 8 tags per word and no value bytes to mask off, so the exact
+// zero-byte test is used instead. The last word reads 4 value bytes past the
+// tags, which the final mask drops.
+static inline uint32_t tag_match_mask_split_swar(const vqf_split_block * restrict block, uint64_t tag) {
+   const uint64_t bcast = tag * ONES_STEP_8;
+   uint32_t result = 0;
+
+   for (int i = 0; i < (QUQU_SLOTS_PER_BLOCK + 7) / 8; i++) {
+      uint64_t word;
+      memcpy(&word, &block->tags[8 * i], sizeof(word));
+
+      uint64_t x = word ^ bcast;
+      uint64_t t = (x & ~MSBS_STEP_8) + ~MSBS_STEP_8;
+      uint64_t zero = ~(t | x | ~MSBS_STEP_8);
+      result |= (uint32_t)(((zero >> 7) * 0x0102040810204080ULL) >> 56) << (8 * i);
+   }
+   return result & ((1UL << QUQU_SLOTS_PER_BLOCK) - 1);
+}
+
+#ifdef __AVX512BW__
+static inline uint32_t tag_match_mask_512(const vqf_interleaved_block * restrict block, uint64_t tag) {
+   //load 32 16 bit copies of the tag
+   __m512i bcast = _mm512_set1_epi16(tag);
+
+   // //and load the block as a 32 16 bit (val, key) pairs
+   __m512i vector = _mm512_loadu_si512(reinterpret_cast<const __m512i*>(block));
+
+   // //clear the values - this cuts off the upper 8 bits of every 16 bit tag.
+   __m512i tags = _mm512_and_si512(vector, _mm512_set1_epi16(TAG_MASK));
+
+   // the first 4 16-bit words of the vector are the metadata.
+   return _mm512_cmpeq_epi16_mask(bcast, tags) >> (sizeof(uint64_t)/2);
+}
+#endif
+
+#ifdef __AVX2__
+// Split layout: the tags are already contiguous bytes, so one 256-bit byte
+// compare covers them with no narrowing step.
+static inline uint32_t tag_match_mask_split_256(const vqf_split_block * restrict block, uint64_t tag) {
+   __m256i bcast = _mm256_set1_epi8(tag);
+   __m256i tags = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block->tags));
+   uint32_t result = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bcast, tags));
+   return result & ((1UL << QUQU_SLOTS_PER_BLOCK) - 1);
+}
+#endif
+
+#ifdef VQF_SPLIT_BLOCKS
+#ifdef __AVX2__
+#define VQF_MATCH_KERNEL "split-avx2"
+static inline uint32_t tag_match_mask(const vqf_block * restrict block, uint64_t tag) {
+   return tag_match_mask_split_256(block, tag);
+}
+#else
+#define VQF_MATCH_KERNEL "split-swar"
+static inline uint32_t tag_match_mask(const vqf_block * restrict block, uint64_t tag) {
+   return tag_match_mask_split_swar(block, tag);
+}
+#endif
+
+// The value stored with slot i.
+static inline uint8_t slot_value(const vqf_block * restrict block, uint64_t i) {
+   return block->vals[i];
+}
+#else
+#ifdef VQF_USE_AVX
+#define VQF_MATCH_KERNEL "avx512"
+static inline uint32_t tag_match_mask(const vqf_block * restrict block, uint64_t tag) {
+   return tag_match_mask_512(block, tag);
+}
+#else
+#define VQF_MATCH_KERNEL "swar"
+static inline uint32_t tag_match_mask(const vqf_block * restrict block, uint64_t tag) {
+   return tag_match_mask_swar(block, tag);
+}
+#endif
+
+static inline uint8_t slot_value(const vqf_block * restrict block, uint64_t i) {
+   return block->tags[i] >> 8;
+}
+#endif
+
+// Returns a mask with bit i set if tags[i] matches tag and lies in the run of
+// bucket block_index.
+static inline uint64_t generate_match_mask(const view& v, uint64_t tag, uint64_t block_index){
+
+   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
+   uint64_t offset = block_index % QUQU_BUCKETS_PER_BLOCK;
+
+   vqf_block * block = &v.blocks[index];
+
+   uint32_t result = tag_match_mask(block, tag);
+
+   uint64_t start = offset != 0 ? lookup_64(block->md, offset -
+         1) : one[0] << (sizeof(uint64_t)/2);
+   uint64_t end = lookup_64(block->md, offset);
+
+   uint64_t mask = (end - start) >> (sizeof(uint64_t)/2);
+
+   VQF_EVENT(match_masks, 1);
+   VQF_EVENT(matched_tags, __builtin_popcountll(mask & result));
+   return (mask & result);
+}
+
+static inline uint64_t alt_block_index(const view& v, uint64_t hash, uint64_t tag) {
+   return ((hash ^ (tag * 0x5bd1e995)) % v.range) >> v.key_remainder_bits;
+}
+
+// If the item goes in the i'th slot (starting from 0) in the block then
+// find the i'th 0 in the metadata, insert a 1 after that and shift the rest
+// by 1 bit.
+// Insert the new tag at the end of its run and shift the rest by 1 slot.
+// Skewed keys can fill a block pair many times over, so the message is
+// printed once; every failed insert still returns false.
+static inline void report_full(void) {
+   static bool reported = false;
+   if (!__atomic_exchange_n(&reported, true, __ATOMIC_RELAXED))
+      fprintf(stderr, "vqf filter is full.\n");
+}
+
+template <bool kThreadSafe = VQF_THREAD_SAFE>
+static inline bool insert(const view& v, uint64_t hash, uint8_t val = 0) {
+   vqf_block * restrict blocks = v.blocks;
+
+   VQF_EVENT(inserts, 1);
+   uint64_t block_index = hash >> v.key_remainder_bits;
+   lock<kThreadSafe>(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
+#if TAG_BITS == 8
+   uint64_t * block_md = &blocks[block_index/QUQU_BUCKETS_PER_BLOCK].md;
+   uint64_t block_free = block_free_slots(*block_md);
+#endif
+   const uint64_t full_free = QUQU_FULL_FREE_SLOTS(kThreadSafe);
+
+   uint64_t val_shifted = ((uint64_t) val) << 8;
+   uint64_t tag = hash & TAG_MASK;
+
+   uint64_t stored_tag = tag | val_shifted;
+
+   //block inidices are not based on hash
+   uint64_t alt_index = alt_block_index(v, hash, tag);
+
+   __builtin_prefetch(&blocks[alt_index/QUQU_BUCKETS_PER_BLOCK]);
+
+   bool chose_alt = false;
+   if (block_free + QUQU_BUCKETS_PER_BLOCK < QUQU_CHECK_ALT && block_index/QUQU_BUCKETS_PER_BLOCK != alt_index/QUQU_BUCKETS_PER_BLOCK) {
+      VQF_EVENT(insert_alt_checks, 1);
+      unlock<kThreadSafe>(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
+      lock_blocks<kThreadSafe>(v, block_index, alt_index);
+#if TAG_BITS == 8
+      uint64_t *alt_block_md = &blocks[alt_index/QUQU_BUCKETS_PER_BLOCK].md;
+      uint64_t alt_block_free = block_free_slots(*alt_block_md);
+#endif
+      // pick the least loaded block
+      if (alt_block_free > block_free) {
+         VQF_EVENT(insert_alt_chosen, 1);
+         unlock<kThreadSafe>(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
+         block_index = alt_index;
+         block_md = alt_block_md;
+         chose_alt = true;
+      } else if (block_free == full_free) {
+         unlock_blocks<kThreadSafe>(v, block_index, alt_index);
+         VQF_EVENT(insert_failures, 1);
+         VQF_PROBE3(insert_full, hash, block_index / QUQU_BUCKETS_PER_BLOCK,
+               alt_index / QUQU_BUCKETS_PER_BLOCK);
+         report_full();
+         return false;
+      } else {
+         unlock<kThreadSafe>(blocks[alt_index/QUQU_BUCKETS_PER_BLOCK]);
+      }
+
+   } else if (block_free == full_free) {
+      // both choices are the same full block
+      unlock<kThreadSafe>(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
+      VQF_EVENT(insert_failures, 1);
+      VQF_PROBE3(insert_full, hash, block_index / QUQU_BUCKETS_PER_BLOCK,
+            alt_index / QUQU_BUCKETS_PER_BLOCK);
+      report_full();
+      return false;
+   }
+
+   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
+   uint64_t offset = block_index % QUQU_BUCKETS_PER_BLOCK;
+   VQF_PROBE4(insert_block, hash, index, block_free_slots(*block_md), chose_alt);
+
+   uint64_t slot_index = select_64(*block_md, offset);
+   uint64_t select_index = slot_index + offset - (sizeof(uint64_t)/2);
+
+   update_tags_512(&blocks[index], slot_index,stored_tag);
+   update_md(block_md, select_index);
+   unlock<kThreadSafe>(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
+   count_entries<kThreadSafe>(v, 1);
+   return true;
+}
+
+static inline bool remove_tags(const view& v, uint64_t tag, uint64_t block_index) {
+   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
+   uint64_t offset = block_index % QUQU_BUCKETS_PER_BLOCK;
+
+   uint64_t check_indexes = generate_match_mask(v, tag, block_index);
+
+   if (check_indexes != 0) { // remove the first available tag
+      uint64_t remove_index = __builtin_ctzll(check_indexes);
+      remove_tags_512(&v.blocks[index], remove_index + (sizeof(uint64_t)/2));
+
+      // the tag's 0 in the metadata is preceded by one 1 per earlier bucket.
+      remove_md(&v.blocks[index].md, remove_index + offset);
+
+      return true;
+   } else
+      return false;
+}
+
+// Both candidate blocks are locked for the whole remove, the same block once.
+// Closing a slot shifts the lock bit down into the metadata as the freed 1,
+// and remove_md sets bit 63 again until the block is unlocked.
+template <bool kThreadSafe = VQF_THREAD_SAFE>
+static inline bool remove(const view& v, uint64_t hash) {
+   uint64_t block_index = hash >> v.key_remainder_bits;
+   uint64_t tag = hash & TAG_MASK;
+   uint64_t alt_index = alt_block_index(v, hash, tag);
+   bool same_block = block_index / QUQU_BUCKETS_PER_BLOCK == alt_index / QUQU_BUCKETS_PER_BLOCK;
+
+   __builtin_prefetch(&v.blocks[alt_index / QUQU_BUCKETS_PER_BLOCK]);
+
+   if (same_block)
+      lock<kThreadSafe>(v.blocks[block_index / QUQU_BUCKETS_PER_BLOCK]);
+   else
+      lock_blocks<kThreadSafe>(v, block_index, alt_index);
+
+   VQF_EVENT(removes, 1);
+   bool removed = remove_tags(v, tag, block_index);
+   if (!removed) {
+      VQF_EVENT(remove_alt_probes, 1);
+      removed = remove_tags(v, tag, alt_index);
+   }
+
+   if (same_block)
+      unlock<kThreadSafe>(v.blocks[block_index / QUQU_BUCKETS_PER_BLOCK]);
+   else
+      unlock_blocks<kThreadSafe>(v, block_index, alt_index);
+   if (removed)
+      count_entries<kThreadSafe>(v, -1);
+   return removed;
+}
+
+static inline bool check_tags(const view& v, uint64_t tag, uint64_t block_index) {
+   return (generate_match_mask(v, tag, block_index) != 0);
+}
+
+static inline bool retrieve_value(const view& v, uint64_t tag, uint64_t block_index, uint8_t & val){
+
+   uint64_t mask = generate_match_mask(v, tag, block_index);
+
+   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
+
+   int first_set = __builtin_ffsll(mask) -1;
+   if (first_set == -1){
+      //not found
+      return false;
+   } else {
+      val = slot_value(&v.blocks[index], first_set);
+      return true;
+   }
+}
+
+static inline bool retrieve_values(const view& v, uint64_t tag, uint64_t block_index, std::vector<uint8_t>& values){
+
+   uint64_t mask = generate_match_mask(v, tag, block_index);
+
+   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
+
+   if(mask == 0) return false;
+
+   while (mask > 0) {
+      values.push_back(slot_value(&v.blocks[index], __builtin_ctzll(mask)));
+      mask &= mask - 1;
+   }
+   return true;
+}
+
+// If the item goes in the i'th slot (starting from 0) in the block then
+// select(i) - i is the slot index for the end of the run.
+static inline bool is_present(const view& v, uint64_t hash) {
+   uint64_t block_index = hash >> v.key_remainder_bits;
+   uint64_t tag = hash & TAG_MASK;
+   uint64_t alt_index = alt_block_index(v, hash, tag);
+
+   __builtin_prefetch(&v.blocks[alt_index / QUQU_BUCKETS_PER_BLOCK]);
+
+   VQF_EVENT(lookups, 1);
+   if (check_tags(v, tag, block_index))
+      return true;
+   VQF_EVENT(lookup_alt_probes, 1);
+   return check_tags(v, tag, alt_index);
+}
+
+// True if hash is found only in its alternate block, i.e. insert took the
+// second choice. A false positive in the primary block hides a true answer,
+// so this slightly undercounts; it is meant for occupancy statistics.
+static inline bool in_alt_block(const view& v, uint64_t hash) {
+   uint64_t block_index = hash >> v.key_remainder_bits;
+   uint64_t tag = hash & TAG_MASK;
+   uint64_t alt_index = alt_block_index(v, hash, tag);
+
+   return block_index / QUQU_BUCKETS_PER_BLOCK != alt_index / QUQU_BUCKETS_PER_BLOCK &&
+      !check_tags(v, tag, block_index) && check_tags(v, tag, alt_index);
+}
+
+static inline bool query(const view& v, uint64_t hash, uint8_t & value) {
+   uint64_t block_index = hash >> v.key_remainder_bits;
+   uint64_t tag = hash & TAG_MASK;
+   uint64_t alt_index = alt_block_index(v, hash, tag);
+
+   __builtin_prefetch(&v.blocks[alt_index / QUQU_BUCKETS_PER_BLOCK]);
+
+   VQF_EVENT(lookups, 1);
+   if (retrieve_value(v, tag, block_index, value))
+      return true;
+   VQF_EVENT(lookup_alt_probes, 1);
+   return retrieve_value(v, tag, alt_index, value);
+}
+
+static inline bool query_iter(const view& v, uint64_t hash, std::vector<uint8_t>& values) {
+   uint64_t block_index = hash >> v.key_remainder_bits;
+   uint64_t tag = hash & TAG_MASK;
+   uint64_t alt_index = alt_block_index(v, hash, tag);
+
+   __builtin_prefetch(&v.blocks[alt_index / QUQU_BUCKETS_PER_BLOCK]);
+
+   VQF_EVENT(lookups, 1);
+   if (retrieve_values(v, tag, block_index, values))
+      return true;
+   VQF_EVENT(lookup_alt_probes, 1);
+   return retrieve_values(v, tag, alt_index, values);
+}
+
+}  // namespace vqf
+
+#endif	// _VQF_INLINE_H_
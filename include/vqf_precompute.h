@@ -9,6 +9,9 @@
  * ============================================================================
  */
 
+#ifndef _VQF_PRECOMPUTE_H_
+#define _VQF_PRECOMPUTE_H_
+
 
 static uint64_t pre_one[64 + 128] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
    1ULL << 0, 1ULL << 1, 1ULL << 2, 1ULL << 3, 1ULL << 4, 1ULL << 5, 1ULL << 6, 1ULL << 7, 1ULL << 8, 1ULL << 9,
@@ -88,3 +91,4 @@ const __m256i K1 = _mm256_setr_epi8(
 
 const __m256i K[] = {K0, K1};
 
+#endif	// _VQF_PRECOMPUTE_H_
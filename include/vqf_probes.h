@@ -0,0 +1,57 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  vqf_probes.h
+ *
+ *    Description:  USDT static tracepoints (provider "vqf") for bpftrace,
+ *                  perf and SystemTap. A probe that nothing is attached to is
+ *                  a single nop, and its arguments are values the code has
+ *                  already computed. The probes are compiled in whenever
+ *                  <sys/sdt.h> is installed (systemtap-sdt-dev); define
+ *                  VQF_NO_USDT to leave them out. scripts/vqf_latency.bt
+ *                  uses them.
+ *
+ *                  insert_entry(filter, hash, val)
+ *                  insert_return(filter, hash, inserted)
+ *                  insert_block(hash, block, free, alternate)
+ *                  insert_full(hash, block, alt_block)
+ *                  remove_entry(filter, hash)
+ *                  remove_return(filter, hash, removed)
+ *                  query_entry(filter, hash)
+ *                  query_return(filter, hash, found)
+ *
+ *                  insert_block fires once the insert has picked a block:
+ *                  its free slots before the insert, and 1 if it is the
+ *                  alternate. insert_full fires on a failed insert. Both come
+ *                  from the inline operations, so they also fire in C++
+ *                  callers of vqf_inline.h; the entry and return probes are
+ *                  in the C API only, and query covers vqf_is_present,
+ *                  vqf_query and vqf_query_iter.
+ *
+ * ============================================================================
+ */
+
+#ifndef _VQF_PROBES_H_
+#define _VQF_PROBES_H_
+
+#if !defined(VQF_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define VQF_USDT 1
+#endif
+#endif
+
+#ifdef VQF_USDT
+#define VQF_PROBE2(name, a, b) DTRACE_PROBE2(vqf, name, a, b)
+#define VQF_PROBE3(name, a, b, c) DTRACE_PROBE3(vqf, name, a, b, c)
+#define VQF_PROBE4(name, a, b, c, d) DTRACE_PROBE4(vqf, name, a, b, c, d)
+#else
+// the arguments still count as used, so values kept only for a probe do
+// not warn
+#define VQF_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define VQF_PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#define VQF_PROBE4(name, a, b, c, d) \
+   do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#endif
+
+#endif	// _VQF_PROBES_H_
@@ -0,0 +1,81 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  vqf_profile.h
+ *
+ *    Description:  Sampling profiler. While it runs, the C API records one
+ *                  operation in about period (the gaps are random, so a
+ *                  periodic workload does not alias) into a ring of the
+ *                  calling thread: start TSC, duration in cycles, operation,
+ *                  result, both candidate blocks and their free slots after
+ *                  the operation. Each thread writes only its own ring, so
+ *                  recording takes no lock, and vqf_profile_collect and
+ *                  vqf_profile_dump read the rings while threads keep
+ *                  writing. A ring keeps its thread's last
+ *                  VQF_PROFILE_RING_SAMPLES samples. When the profiler is
+ *                  off, the cost is one compare per call.
+ *
+ * ============================================================================
+ */
+
+#ifndef _VQF_PROFILE_H_
+#define _VQF_PROFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include "vqf_filter.h"
+#include "vqf_trace.h"
+
+#define VQF_PROFILE_RING_SAMPLES 4096
+#define VQF_PROFILE_PERIOD 1024
+
+typedef struct vqf_profile_sample {
+   uint64_t start;            // TSC cycles since vqf_profile_start
+   uint64_t block;            // the hash's primary block
+   uint64_t alt_block;
+   uint32_t cycles;           // TSC cycles the operation took
+   uint16_t ring;             // a ring passes to a new thread when its thread exits
+   uint8_t op;                // vqf_trace_op, | VQF_TRACE_RESULT
+   uint8_t block_free;        // free slots after the operation
+   uint8_t alt_free;
+} vqf_profile_sample;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Samples one operation in about period (at least 1) on every filter,
+   // dropping the samples of an earlier run.
+   void vqf_profile_start(uint32_t period);
+
+   // Stops sampling. The rings keep their samples for collect and dump.
+   void vqf_profile_stop(void);
+
+   // Called by the C API; callers of the inline API in vqf_inline.h can
+   // bracket their operations with these to profile them.
+   bool vqf_profile_tick(uint64_t *start);
+   void vqf_profile_record(const vqf_filter *filter, uint8_t op, uint64_t hash, bool result,
+         uint64_t start);
+
+   // Appends every ring's samples, oldest first within a ring.
+   void vqf_profile_collect(std::vector<vqf_profile_sample>& samples);
+
+   // Writes the samples as text, in time order, and returns how many.
+   uint64_t vqf_profile_dump(FILE *fp);
+
+   extern uint32_t vqf_profile_period;
+
+#ifdef __cplusplus
+}
+#endif
+
+// True if this operation is sampled; *start is then its start TSC.
+static inline bool vqf_profile_begin(uint64_t *start) {
+   if (__builtin_expect(__atomic_load_n(&vqf_profile_period, __ATOMIC_RELAXED) == 0, 1))
+      return false;
+   return vqf_profile_tick(start);
+}
+
+#endif	// _VQF_PROFILE_H_
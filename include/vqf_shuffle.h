@@ -0,0 +1,61 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  vqf_shuffle.h
+ *
+ *    Description:  Permutation vectors used to open or close a slot in a
+ *                  512-bit block. They are generated at compile time for each
+ *                  lane width, replacing the output of the old offline
+ *                  generator (generate_shuffle_matrix.cc).
+ *
+ *         Author:  Prashant Pandey (), ppandey@berkeley.edu
+ *   Organization:  LBNL/UCB
+ *
+ * ============================================================================
+ */
+
+#ifndef _VQF_SHUFFLE_H_
+#define _VQF_SHUFFLE_H_
+
+#include <stdint.h>
+
+namespace vqf {
+
+template <typename Lane>
+struct shuffle_table {
+   static constexpr unsigned kLanes = 64 / sizeof(Lane);
+
+   // insert[i] moves the last lane (holding the new tag) to lane i and shifts
+   // lanes i..kLanes-2 up by one.
+   alignas(64) Lane insert[kLanes][kLanes];
+   // remove[i] shifts lanes i+1..kLanes-1 down by one and keeps the last lane.
+   alignas(64) Lane remove[kLanes][kLanes];
+};
+
+template <typename Lane>
+constexpr shuffle_table<Lane> make_shuffle_table() {
+   shuffle_table<Lane> t = {};
+   const unsigned n = shuffle_table<Lane>::kLanes;
+
+   for (unsigned index = 0; index < n; index++) {
+      for (unsigned i = 0; i < n; i++) {
+         t.insert[index][i] = i < index ? i : i == index ? n - 1 : i - 1;
+         t.remove[index][i] = i < index ? i : i < n - 1 ? i + 1 : n - 1;
+      }
+   }
+   return t;
+}
+
+// One table per lane width: shuffle<uint8_t> permutes 64 8-bit lanes with
+// vpermb, shuffle<uint16_t> permutes 32 16-bit lanes with vpermw.
+template <typename Lane>
+struct shuffle {
+   static constexpr shuffle_table<Lane> table = make_shuffle_table<Lane>();
+};
+
+template <typename Lane>
+constexpr shuffle_table<Lane> shuffle<Lane>::table;
+
+}  // namespace vqf
+
+#endif	// _VQF_SHUFFLE_H_
@@ -0,0 +1,130 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  vqf_trace.h
+ *
+ *    Description:  Operation traces. While a trace is running, every call
+ *                  to the C API on the traced filter appends a 20-byte entry
+ *                  (TSC timestamp, hash, thread, operation, value and
+ *                  result) to a per-thread buffer, which is written to the
+ *                  trace file when it fills, when its thread exits and when
+ *                  the trace stops. When no trace is running, the cost is
+ *                  one compare per call. replay applies a trace to a filter
+ *                  of any size and build.
+ *
+ *                  The file is a vqf_trace_header followed by the entries.
+ *                  Entries of one thread are in time order; entries of
+ *                  different threads are interleaved in blocks.
+ *
+ * ============================================================================
+ */
+
+#ifndef _VQF_TRACE_H_
+#define _VQF_TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "vqf_filter.h"
+
+#define VQF_TRACE_MAGIC "VQFTRACE"
+#define VQF_TRACE_VERSION 1
+
+// Set in vqf_trace_entry.op when the call returned true.
+#define VQF_TRACE_RESULT 0x80
+
+enum vqf_trace_op {
+   VQF_TRACE_INSERT,
+   VQF_TRACE_REMOVE,
+   VQF_TRACE_IS_PRESENT,
+   VQF_TRACE_QUERY,
+   VQF_TRACE_NUM_OPS
+};
+
+typedef struct __attribute__ ((__packed__)) vqf_trace_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t entry_size;
+   uint64_t nslots;           // of the traced filter
+   uint64_t range;
+   uint64_t nentries;         // written by vqf_trace_stop
+   double nsec_per_cycle;     // of the timestamps, written by vqf_trace_stop
+} vqf_trace_header;
+
+typedef struct __attribute__ ((__packed__)) vqf_trace_entry {
+   uint64_t cycles;           // TSC cycles since vqf_trace_start
+   uint64_t hash;
+   uint16_t thread;           // in the order threads first touched the trace
+   uint8_t op;                // vqf_trace_op, | VQF_TRACE_RESULT
+   uint8_t value;             // inserted, or found by vqf_query
+} vqf_trace_entry;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Starts tracing filter to path. Only one filter is traced at a time;
+   // returns false if a trace is running or path cannot be written.
+   bool vqf_trace_start(vqf_filter *filter, const char *path);
+
+   // Writes out every thread's buffer and closes the trace. No operation on
+   // the traced filter may be in flight. Returns false if no trace was
+   // running or the file could not be written.
+   bool vqf_trace_stop(void);
+
+   // Records one operation. The C API calls this itself; callers of the
+   // inline API in vqf_inline.h can call it to trace their operations.
+   void vqf_trace_record(vqf_filter *filter, uint8_t op, uint64_t hash, uint8_t value,
+         bool result);
+
+   extern vqf_filter *vqf_traced_filter;
+
+#ifdef __cplusplus
+}
+#endif
+
+// Reads a whole trace. Prints the reason and returns false if path is not a
+// trace of this version.
+static inline bool vqf_trace_read(const char *path, vqf_trace_header *header,
+      std::vector<vqf_trace_entry>& entries) {
+   FILE *fp = fopen(path, "rb");
+   if (fp == NULL) {
+      perror(path);
+      return false;
+   }
+   bool ok = fread(header, sizeof(*header), 1, fp) == 1 &&
+      memcmp(header->magic, VQF_TRACE_MAGIC, sizeof(header->magic)) == 0;
+   if (!ok)
+      fprintf(stderr, "%s is not a vqf trace\n", path);
+   else if (header->version != VQF_TRACE_VERSION || header->entry_size != sizeof(vqf_trace_entry)) {
+      fprintf(stderr, "%s is trace version %u; this build reads version %d\n", path,
+            header->version, VQF_TRACE_VERSION);
+      ok = false;
+   } else if (header->nsec_per_cycle == 0) {
+      fprintf(stderr, "%s was not closed with vqf_trace_stop\n", path);
+      ok = false;
+   } else {
+      entries.resize(header->nentries);
+      if (fread(entries.data(), sizeof(vqf_trace_entry), entries.size(), fp) != entries.size()) {
+         fprintf(stderr, "%s is truncated\n", path);
+         ok = false;
+      }
+   }
+   fclose(fp);
+   return ok;
+}
+
+// Maps a traced hash onto a filter of another range. The bucket part scales
+// with the range, so the keys cover the same share of the blocks as in the
+// traced filter, and the tag (the low remainder_bits) is kept.
+static inline uint64_t vqf_trace_rescale(uint64_t hash, uint64_t from_range, uint64_t to_range,
+      uint64_t remainder_bits) {
+   uint64_t bucket = (hash % from_range) >> remainder_bits;
+   bucket = (unsigned __int128)bucket * (to_range >> remainder_bits) /
+      (from_range >> remainder_bits);
+   return bucket << remainder_bits | (hash & ((1ULL << remainder_bits) - 1));
+}
+
+#endif	// _VQF_TRACE_H_
@@ -13,6 +13,7 @@
 #define VQF_WRAPPER_H
 
 #include "vqf_filter.h"
+#include "vqf_inline.h"
 
 vqf_filter *q_filter;
 
@@ -45,13 +46,31 @@ inline int q_remove(__uint128_t val)
 	return 1;
 }
 
+inline int q_alt_lookup(__uint128_t val)
+{
+	return vqf::in_alt_block(vqf::make_view(q_filter), val);
+}
+
 inline __uint128_t q_range()
 {
 	return q_filter->metadata.range;
 }
 
+inline void q_print_stats(FILE *fp)
+{
+	vqf_stats stats;
+	vqf_get_stats(q_filter, &stats);
+	vqf_print_stats(fp, &stats);
+}
+
+inline uint64_t q_bytes()
+{
+	return sizeof(*q_filter) + q_filter->metadata.total_size_in_bytes;
+}
+
 inline int q_destroy()
 {
+	free(q_filter);
 	return 0;
 }
 
@@ -0,0 +1,87 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  zipf.h
+ *
+ *    Description:  Skewed key generation shared by the benchmark drivers.
+ *
+ * ============================================================================
+ */
+
+#ifndef _ZIPF_H_
+#define _ZIPF_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* Bijective 64-bit mixer (the splitmix64 finalizer), used to turn ranks and
+ * counters into keys spread over the whole range. */
+static inline uint64_t mix64(uint64_t x) {
+   x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+   return x ^ (x >> 31);
+}
+
+/* Zipfian ranks in [1, n] with P(k) proportional to 1/k^exponent, for any
+ * exponent > 0, by rejection-inversion: Hormann and Derflinger, "Rejection-
+ * inversion to generate variates from monotone discrete distributions", 1996.
+ * Sampling takes O(1) expected time and no O(n) table. */
+typedef struct zipf_sampler {
+   uint64_t n;
+   double exponent;
+   double h_integral_x1;
+   double h_integral_n;
+   double s;
+} zipf_sampler;
+
+/* log(1 + x) / x, and (exp(x) - 1) / x, accurate near 0 */
+static inline double zipf_helper1(double x) {
+   return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static inline double zipf_helper2(double x) {
+   return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static inline double zipf_h(const zipf_sampler *z, double x) {
+   return exp(-z->exponent * log(x));
+}
+
+static inline double zipf_h_integral(const zipf_sampler *z, double x) {
+   double log_x = log(x);
+   return zipf_helper2((1 - z->exponent) * log_x) * log_x;
+}
+
+static inline double zipf_h_integral_inverse(const zipf_sampler *z, double x) {
+   double t = x * (1 - z->exponent);
+   if (t < -1)
+      t = -1;
+   return exp(zipf_helper1(t) * x);
+}
+
+static inline void zipf_sampler_init(zipf_sampler *z, uint64_t n, double exponent) {
+   z->n = n;
+   z->exponent = exponent;
+   z->h_integral_x1 = zipf_h_integral(z, 1.5) - 1;
+   z->h_integral_n = zipf_h_integral(z, n + 0.5);
+   z->s = 2 - zipf_h_integral_inverse(z, zipf_h_integral(z, 2.5) - zipf_h(z, 2));
+}
+
+static inline uint64_t zipf_sample(const zipf_sampler *z, struct drand48_data *rand) {
+   while (1) {
+      double r;
+      drand48_r(rand, &r);
+      double u = z->h_integral_n + r * (z->h_integral_x1 - z->h_integral_n);
+      double x = zipf_h_integral_inverse(z, u);
+      uint64_t k = (uint64_t)(x + 0.5);
+      if (k < 1)
+         k = 1;
+      else if (k > z->n)
+         k = z->n;
+      if (k - x <= z->s || u >= zipf_h_integral(z, k + 0.5) - zipf_h(z, k))
+         return k;
+   }
+}
+
+#endif	// _ZIPF_H_
@@ -0,0 +1,125 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  bench_compare.cc
+ *
+ *    Description:  Compares two result files written by main, bm or workload
+ *                  (JSON or CSV, see bench_report.h). Prints the configuration
+ *                  keys that differ and, for every phase and point in both
+ *                  files, the change in the median. Exits with status 1 if any
+ *                  throughput dropped, or any latency (unit ns) rose, by more
+ *                  than the threshold, so a library upgrade can be gated on a
+ *                  baseline taken on the same machine.
+ *
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_report.h"
+
+static void usage(const char *name) {
+   printf("%s [OPTIONS] baseline candidate\n"
+         "Options are:\n"
+         "  -t percent     [ flag a phase whose median throughput dropped, or whose\n"
+         "                   median latency rose, by more than percent.  Default 5 ]\n",
+         name);
+}
+
+static const std::string *config_value(const bench_report *r, const std::string& key) {
+   for (size_t i = 0; i < r->config.size(); i++)
+      if (r->config[i].first == key)
+         return &r->config[i].second;
+   return NULL;
+}
+
+static bool same_value(const std::string& a, const std::string& b) {
+   if (bench_is_number(a) && bench_is_number(b))
+      return atof(a.c_str()) == atof(b.c_str());
+   return a == b;
+}
+
+static const bench_result *find_result(const bench_report *r, const bench_result& res) {
+   for (size_t i = 0; i < r->results.size(); i++)
+      if (r->results[i].phase == res.phase && r->results[i].point == res.point)
+         return &r->results[i];
+   return NULL;
+}
+
+int main(int argc, char **argv)
+{
+   double threshold = 5;
+   int opt;
+   char *term;
+
+   while ((opt = getopt(argc, argv, "t:")) != -1) {
+      switch (opt) {
+         case 't':
+            threshold = strtod(optarg, &term);
+            if (*term || threshold < 0) {
+               fprintf(stderr, "Argument to -t must be a non-negative number\n");
+               exit(2);
+            }
+            break;
+         default:
+            usage(argv[0]);
+            exit(2);
+      }
+   }
+   if (argc - optind != 2) {
+      usage(argv[0]);
+      exit(2);
+   }
+
+   bench_report base, cand;
+   if (!bench_report_read(&base, argv[optind]) || !bench_report_read(&cand, argv[optind + 1]))
+      exit(2);
+   if (base.results.empty() || cand.results.empty()) {
+      fprintf(stderr, "No results to compare\n");
+      exit(2);
+   }
+
+   // a changed configuration makes the comparison suspect, but not invalid
+   for (size_t i = 0; i < base.config.size(); i++) {
+      const std::string *v = config_value(&cand, base.config[i].first);
+      if (v == NULL || !same_value(*v, base.config[i].second))
+         printf("config %s: %s -> %s\n", base.config[i].first.c_str(),
+               base.config[i].second.c_str(), v ? v->c_str() : "(missing)");
+   }
+   for (size_t i = 0; i < cand.config.size(); i++)
+      if (config_value(&base, cand.config[i].first) == NULL)
+         printf("config %s: (missing) -> %s\n", cand.config[i].first.c_str(),
+               cand.config[i].second.c_str());
+
+   uint64_t nregressions = 0;
+   printf("%-26s %6s %12s %12s %9s %12s\n", "phase", "point", "baseline", "candidate",
+         "change", "");
+   for (size_t i = 0; i < base.results.size(); i++) {
+      const bench_result& b = base.results[i];
+      const bench_result *c = find_result(&cand, b);
+      if (c == NULL) {
+         printf("%-26s %6g %12.3f %12s\n", b.phase.c_str(), b.point, b.median, "(missing)");
+         continue;
+      }
+      double change = b.median > 0 ? 100.0 * (c->median - b.median) / b.median : 0;
+      bool regression = b.unit == "ns" ? change > threshold : change < -threshold;
+      nregressions += regression;
+      printf("%-26s %6g %12.3f %12.3f %8.1f%% %12s\n", b.phase.c_str(), b.point, b.median,
+            c->median, change, regression ? "REGRESSION" : "");
+   }
+   for (size_t i = 0; i < cand.results.size(); i++)
+      if (find_result(&base, cand.results[i]) == NULL)
+         printf("%-26s %6g %12s %12.3f\n", cand.results[i].phase.c_str(),
+               cand.results[i].point, "(missing)", cand.results[i].median);
+
+   if (nregressions > 0) {
+      printf("%lu regression%s beyond %g%%\n", nregressions, nregressions > 1 ? "s" : "",
+            threshold);
+      return 1;
+   }
+   printf("No regression beyond %g%%\n", threshold);
+   return 0;
+}
@@ -17,6 +17,7 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <openssl/rand.h>
 #include <stdio.h>
 #include <math.h>
@@ -28,6 +29,14 @@
 #include <unistd.h>
 
 #include "vqf_wrapper.h"
+#include "bloom_wrapper.h"
+#include "cuckoo_wrapper.h"
+#include "map_wrapper.h"
+#include "vqf_inline.h"
+#include "latency_histogram.h"
+#include "perf_counters.h"
+#include "zipf.h"
+#include "bench_report.h"
 
 typedef void *(*rand_init)(uint64_t maxoutputs, __uint128_t maxvalue,
                            void *params);
@@ -38,8 +47,11 @@ typedef int (*init_op)(uint64_t nvals);
 typedef int (*insert_op)(__uint128_t val);
 typedef int (*lookup_op)(__uint128_t val);
 typedef int (*remove_op)(__uint128_t val);
+typedef int (*alt_lookup_op)(__uint128_t val);
 typedef __uint128_t (*get_range_op)();
 typedef int (*destroy_op)();
+typedef uint64_t (*bytes_op)();
+typedef void (*print_stats_op)(FILE *fp);
 
 typedef struct rand_generator {
   rand_init init;
@@ -51,11 +63,30 @@ typedef struct filter {
   init_op init;
   insert_op insert;
   lookup_op lookup;
+  /* NULL if the filter cannot remove; the remove phase is then skipped */
 	remove_op remove;
   get_range_op range;
   destroy_op destroy;
+  /* 1 if val is stored in its second-choice location; NULL if the filter has
+   * no such notion */
+  alt_lookup_op alt_lookup;
+  /* Bytes the structure occupies now */
+  bytes_op bytes;
+  /* Prints the structure's own space report; NULL if it has none */
+  print_stats_op print_stats;
 } filter;
 
+/* The filter at one load-factor point of one run */
+typedef struct point_stats {
+  double load;
+  uint64_t nitems;
+  uint64_t insert_failures;
+  uint64_t missed;
+  uint64_t fps;
+  uint64_t in_alt;
+  double bits_per_item;
+} point_stats;
+
 typedef struct uniform_pregen_state {
   uint64_t maxoutputs;
   uint64_t nextoutput;
@@ -171,13 +202,167 @@ void *uniform_online_duplicate(void *_state) {
   return newstate;
 }
 
+/* Parameters of the skewed generators, passed as the params argument of
+ * rand_init. */
+typedef struct skew_params {
+  double exponent;
+} skew_params;
+
+static inline __uint128_t rank_to_key(uint64_t rank, uint64_t seed,
+                                      __uint128_t maxvalue) {
+  __uint128_t key = ((__uint128_t)mix64(rank ^ seed) << 64) |
+                    mix64(rank + seed);
+  return key % maxvalue;
+}
+
+static uint64_t random_seed(void) {
+  uint64_t seed;
+  RAND_bytes((unsigned char *)&seed, sizeof(seed));
+  return seed;
+}
+
+static double skew_exponent(void *params) {
+  return params != NULL ? ((skew_params *)params)->exponent : 0.99;
+}
+
+/* The pregen skewed generators fill a uniform_pregen_state and share its
+ * gen_rand and duplicate. Each init draws a new seed, so two generators give
+ * disjoint key sets with the same popularity skew. */
+static uniform_pregen_state *skewed_pregen_alloc(uint64_t maxoutputs) {
+  uniform_pregen_state *state =
+      (uniform_pregen_state *)malloc(sizeof(uniform_pregen_state));
+  assert(state != NULL);
+  state->nextoutput = 0;
+  state->maxoutputs = maxoutputs;
+  state->outputs =
+      (__uint128_t *)malloc(state->maxoutputs * sizeof(state->outputs[0]));
+  assert(state->outputs != NULL);
+  return state;
+}
+
+/* Ranks are drawn over as many distinct keys as there are outputs. */
+void *zipfian_pregen_init(uint64_t maxoutputs, __uint128_t maxvalue,
+                          void *params) {
+  uniform_pregen_state *state = skewed_pregen_alloc(maxoutputs);
+  uint64_t seed = random_seed();
+  struct drand48_data rand;
+  zipf_sampler z;
+  uint64_t i;
+
+  srand48_r(seed, &rand);
+  zipf_sampler_init(&z, maxoutputs, skew_exponent(params));
+  for (i = 0; i < state->maxoutputs; i++)
+    state->outputs[i] = rank_to_key(zipf_sample(&z, &rand), seed, maxvalue);
+
+  return (void *)state;
+}
+
+typedef struct zipfian_online_state {
+  __uint128_t maxvalue;
+  uint64_t seed;
+  zipf_sampler z;
+  struct drand48_data rand;
+} zipfian_online_state;
+
+void *zipfian_online_init(uint64_t maxoutputs, __uint128_t maxvalue,
+                          void *params) {
+  zipfian_online_state *state =
+      (zipfian_online_state *)malloc(sizeof(zipfian_online_state));
+  assert(state != NULL);
+
+  state->maxvalue = maxvalue;
+  state->seed = random_seed();
+  srand48_r(state->seed, &state->rand);
+  zipf_sampler_init(&state->z, maxoutputs, skew_exponent(params));
+  return (void *)state;
+}
+
+int zipfian_online_gen_rand(void *_state, uint64_t noutputs,
+                            __uint128_t *outputs) {
+  zipfian_online_state *state = (zipfian_online_state *)_state;
+  uint64_t i;
+  for (i = 0; i < noutputs; i++)
+    outputs[i] = rank_to_key(zipf_sample(&state->z, &state->rand), state->seed,
+                             state->maxvalue);
+  return noutputs;
+}
+
+/* The copy replays the same stream from the point it was taken. */
+void *zipfian_online_duplicate(void *state) {
+  zipfian_online_state *newstate =
+      (zipfian_online_state *)malloc(sizeof(*newstate));
+  assert(newstate);
+  memcpy(newstate, state, sizeof(*newstate));
+  return newstate;
+}
+
+/* A crude model of the k-mers of a repetitive genome. Outputs come in
+ * segments of GENOME_REPEAT_LEN k-mers. A GENOME_REPEAT_FRACTION of segments
+ * are copies of one of GENOME_REPEAT_FAMILIES repeat elements, picked with
+ * zipfian popularity so a few families dominate as Alu and L1 do; each k-mer
+ * of a copy has diverged to a unique one with probability GENOME_DIVERGENCE.
+ * The other segments are unique sequence. */
+#define GENOME_REPEAT_FAMILIES 1024
+#define GENOME_REPEAT_LEN 300
+#define GENOME_REPEAT_FRACTION 0.45
+#define GENOME_DIVERGENCE 0.1
+
+void *genomic_repeats_init(uint64_t maxoutputs, __uint128_t maxvalue,
+                           void *params) {
+  uniform_pregen_state *state = skewed_pregen_alloc(maxoutputs);
+  uint64_t seed = random_seed();
+  // repeat k-mers are ranks below this, unique k-mers are counted above it
+  uint64_t unique = GENOME_REPEAT_FAMILIES * GENOME_REPEAT_LEN;
+  struct drand48_data rand;
+  zipf_sampler families;
+  uint64_t i = 0;
+
+  srand48_r(seed, &rand);
+  zipf_sampler_init(&families, GENOME_REPEAT_FAMILIES, skew_exponent(params));
+  while (i < state->maxoutputs) {
+    double r;
+    drand48_r(&rand, &r);
+    uint64_t family =
+        r < GENOME_REPEAT_FRACTION ? zipf_sample(&families, &rand) : 0;
+    for (uint64_t k = 0; k < GENOME_REPEAT_LEN && i < state->maxoutputs;
+         k++, i++) {
+      drand48_r(&rand, &r);
+      uint64_t rank = family != 0 && r >= GENOME_DIVERGENCE
+                          ? (family - 1) * GENOME_REPEAT_LEN + k
+                          : unique++;
+      state->outputs[i] = rank_to_key(rank, seed, maxvalue);
+    }
+  }
+
+  return (void *)state;
+}
+
 rand_generator uniform_pregen = {uniform_pregen_init, uniform_pregen_gen_rand,
                                  uniform_pregen_duplicate};
 
 rand_generator uniform_online = {uniform_online_init, uniform_online_gen_rand,
                                  uniform_online_duplicate};
 
-filter cf = {q_init, q_insert, q_lookup, q_remove, q_range, q_destroy};
+rand_generator zipfian_pregen = {zipfian_pregen_init, uniform_pregen_gen_rand,
+                                 uniform_pregen_duplicate};
+
+rand_generator zipfian_online = {zipfian_online_init, zipfian_online_gen_rand,
+                                 zipfian_online_duplicate};
+
+rand_generator genomic_repeats = {genomic_repeats_init, uniform_pregen_gen_rand,
+                                  uniform_pregen_duplicate};
+
+filter cf = {q_init,    q_insert,     q_lookup, q_remove,     q_range,
+             q_destroy, q_alt_lookup, q_bytes,  q_print_stats};
+
+filter bf = {bf_init,    bf_insert, bf_lookup, NULL, bf_range,
+             bf_destroy, NULL,      bf_bytes,  NULL};
+
+filter cuckoo = {ck_init,    ck_insert,     ck_lookup, ck_remove, ck_range,
+                 ck_destroy, ck_alt_lookup, ck_bytes,  NULL};
+
+filter map = {um_init,    um_insert, um_lookup, um_remove, um_range,
+              um_destroy, NULL,      um_bytes,  NULL};
 
 uint64_t tv2usec(struct timeval tv) {
   return 1000000 * tv.tv_sec + tv.tv_usec;
@@ -192,6 +377,24 @@ int cmp_uint64_t(const void *a, const void *b) {
   return *ua < *ub ? -1 : *ua == *ub ? 0 : 1;
 }
 
+/* Prints the latencies of one point and appends them to the latency file. */
+void print_latency_point(const char *filename, unsigned run, double load,
+                         const char *name, const latency_histogram *h) {
+  double scale = latency_nsec_per_cycle();
+  FILE *fp = fopen(filename, "a");
+  latency_print(stdout, name, h);
+  if (fp == NULL || h->count == 0) {
+    if (fp != NULL)
+      fclose(fp);
+    return;
+  }
+  fprintf(fp, "%u %.2f \"%s\" %lu %.0f %.0f %.0f %.0f %.0f\n", run, load, name,
+          h->count, latency_percentile(h, 0.5) * scale,
+          latency_percentile(h, 0.9) * scale, latency_percentile(h, 0.99) * scale,
+          latency_percentile(h, 0.999) * scale, h->max * scale);
+  fclose(fp);
+}
+
 void usage(char *name) {
   printf(
       "%s [OPTIONS]\n"
@@ -203,24 +406,39 @@ void usage(char *name) {
       "                    uniform_pregen\n"
       "                    uniform_online\n"
       "                    zipfian_pregen\n"
+      "                    zipfian_online\n"
+      "                    genomic_repeats\n"
       "                  Default uniform_pregen ]\n"
-      "  -d datastruct  [ Default qf. ]\n"
-      "  -f outputfile  [ Default qf. ]\n",
+      "  -s exponent   [ Skew of zipfian_* and of the repeat families of\n"
+      "                  genomic_repeats.  Default 0.99 ]\n"
+      "  -S period     [ Time one operation in period, a power of two, for\n"
+      "                  the latency percentiles.  Default 16 ]\n"
+      "  -d datastruct  [ cf (the VQF), bf (register-blocked Bloom), cuckoo\n"
+      "                   or map (std::unordered_map).  Bloom and cuckoo get\n"
+      "                   the VQF's bytes.  Default cf ]\n"
+      "  -f outputfile  [ Default qf. ]\n"
+      "  -j resultfile  [ Also write every point with its configuration and\n"
+      "                   the median and stddev over runs as JSON, or as CSV\n"
+      "                   if the name ends in .csv.  Default none ]\n",
       name);
 }
 
 int main(int argc, char **argv) {
-  uint32_t nbits = 0, nruns = 0;
-  unsigned int npoints = 0;
+  uint32_t nbits = 24, nruns = 1;
+  unsigned int npoints = 20;
   uint64_t nslots = 0, nvals = 0;
   char *randmode = "uniform_pregen";
-  char *datastruct = "qf";
+  char *datastruct = "cf";
   char *outputfile = "qf";
+  char *resultfile = NULL;
+  skew_params skew = {0.99};
+  uint64_t sample_mask = LATENCY_SAMPLE_PERIOD - 1;
 
   filter filter_ds;
   rand_generator *vals_gen;
   void *vals_gen_state;
   void *old_vals_gen_state;
+  void *alt_vals_gen_state;
   void *remove_vals_gen_state;
   rand_generator *othervals_gen;
   void *othervals_gen_state;
@@ -228,32 +446,42 @@ int main(int argc, char **argv) {
   //	__uint128_t *vals;
   //	__uint128_t *othervals;
 
-  unsigned int i, j, exp, run;
-  struct timeval tv_insert[100][1];
-  struct timeval tv_exit_lookup[100][1];
-  struct timeval tv_false_lookup[100][1];
-  struct timeval tv_remove[100][1];
-  uint64_t fps = 0;
-
-  FILE *fp_insert;
-  FILE *fp_exit_lookup;
-  FILE *fp_false_lookup;
-  FILE *fp_remove;
+  uint64_t i;
+  unsigned int point, run;
+  struct timeval tv_start, tv_end;
+
+  /* The operations timed at each load-factor point */
+  enum { OP_INSERT, OP_EXIT_LOOKUP, OP_FALSE_LOOKUP, OP_REMOVE, NUM_OPS };
+  const char *op_names[NUM_OPS] = {"insert", "exists lookup", "false lookup",
+                                   "remove"};
+  const char *op_suffixes[NUM_OPS] = {"-insert.txt", "-exists-lookup.txt",
+                                      "-false-lookup.txt", "-remove.txt"};
+  /* Latencies of one load-factor point, by operation */
+  static latency_histogram lat[NUM_OPS];
+  /* Hardware counters of each phase, if perf events are permitted */
+  perf_counters pc;
+  /* Throughput of every phase and point in every run, for -j */
+  bench_report report;
+  /* Throughput of each operation at each point of each run, in Mops/s,
+   * indexed by point * nruns + run, and the filter state at each point */
+  double *mops[NUM_OPS];
+  point_stats *stats;
+  /* Bytes of the structure when it is fullest */
+  uint64_t bytes = 0;
+
+  FILE *fp;
   const char *dir = "./";
-  const char *insert_op = "-insert.txt\0";
-  const char *exit_lookup_op = "-exists-lookup.txt\0";
-  const char *false_lookup_op = "-false-lookup.txt\0";
-  const char *remove_op = "-remove.txt\0";
-  char filename_insert[256];
-  char filename_exit_lookup[256];
-  char filename_false_lookup[256];
-  char filename_remove[256];
+  const char *latency_op = "-latency.txt";
+  const char *points_op = "-points.txt";
+  char filename[NUM_OPS][256];
+  char filename_latency[256];
+  char filename_points[256];
 
   /* Argument parsing */
   int opt;
   char *term;
 
-  while ((opt = getopt(argc, argv, "n:r:p:m:d:f:")) != -1) {
+  while ((opt = getopt(argc, argv, "n:r:p:m:s:S:d:f:j:")) != -1) {
     switch (opt) {
       case 'n':
         nbits = strtol(optarg, &term, 10);
@@ -262,21 +490,19 @@ int main(int argc, char **argv) {
           usage(argv[0]);
           exit(1);
         }
-        nslots = (1ULL << nbits);
-        nvals = 950 * nslots / 1000;
         break;
       case 'r':
         nruns = strtol(optarg, &term, 10);
-        if (*term) {
-          fprintf(stderr, "Argument to -r must be an integer\n");
+        if (*term || nruns == 0) {
+          fprintf(stderr, "Argument to -r must be a positive integer\n");
           usage(argv[0]);
           exit(1);
         }
         break;
       case 'p':
         npoints = strtol(optarg, &term, 10);
-        if (*term) {
-          fprintf(stderr, "Argument to -p must be an integer\n");
+        if (*term || npoints == 0) {
+          fprintf(stderr, "Argument to -p must be a positive integer\n");
           usage(argv[0]);
           exit(1);
         }
@@ -284,12 +510,33 @@ int main(int argc, char **argv) {
       case 'm':
         randmode = optarg;
         break;
+      case 's':
+        skew.exponent = strtod(optarg, &term);
+        if (*term || skew.exponent <= 0) {
+          fprintf(stderr, "Argument to -s must be a positive number\n");
+          usage(argv[0]);
+          exit(1);
+        }
+        break;
+      case 'S': {
+        uint64_t period = strtoull(optarg, &term, 10);
+        if (*term || period == 0 || (period & (period - 1)) != 0) {
+          fprintf(stderr, "Argument to -S must be a power of two\n");
+          usage(argv[0]);
+          exit(1);
+        }
+        sample_mask = period - 1;
+        break;
+      }
       case 'd':
         datastruct = optarg;
         break;
       case 'f':
         outputfile = optarg;
         break;
+      case 'j':
+        resultfile = optarg;
+        break;
       default:
         fprintf(stderr, "Unknown option\n");
         usage(argv[0]);
@@ -298,12 +545,24 @@ int main(int argc, char **argv) {
     }
   }
 
+  nslots = 1ULL << nbits;
+  nvals = 950 * nslots / 1000;
+
   if (strcmp(randmode, "uniform_pregen") == 0) {
     vals_gen = &uniform_pregen;
     othervals_gen = &uniform_pregen;
   } else if (strcmp(randmode, "uniform_online") == 0) {
     vals_gen = &uniform_online;
     othervals_gen = &uniform_online;
+  } else if (strcmp(randmode, "zipfian_pregen") == 0) {
+    vals_gen = &zipfian_pregen;
+    othervals_gen = &zipfian_pregen;
+  } else if (strcmp(randmode, "zipfian_online") == 0) {
+    vals_gen = &zipfian_online;
+    othervals_gen = &zipfian_online;
+  } else if (strcmp(randmode, "genomic_repeats") == 0) {
+    vals_gen = &genomic_repeats;
+    othervals_gen = &genomic_repeats;
   } else {
     fprintf(stderr, "Unknown randmode.\n");
     usage(argv[0]);
@@ -316,187 +575,300 @@ int main(int argc, char **argv) {
     //		filter_ds = gqf;
     //	} else if (strcmp(datastruct, "qf") == 0) {
     //		filter_ds = qf;
-    //	} else if (strcmp(datastruct, "bf") == 0) {
-    //		filter_ds = bf;
+  } else if (strcmp(datastruct, "bf") == 0) {
+    filter_ds = bf;
+  } else if (strcmp(datastruct, "cuckoo") == 0) {
+    filter_ds = cuckoo;
+  } else if (strcmp(datastruct, "map") == 0) {
+    filter_ds = map;
   } else {
-    fprintf(stderr, "Unknown randmode.\n");
+    fprintf(stderr, "Unknown datastruct.\n");
     usage(argv[0]);
     exit(1);
   }
 
-  snprintf(filename_insert,
-           strlen(dir) + strlen(outputfile) + strlen(insert_op) + 1, "%s%s%s",
-           dir, outputfile, insert_op);
-  snprintf(filename_exit_lookup,
-           strlen(dir) + strlen(outputfile) + strlen(exit_lookup_op) + 1,
-           "%s%s%s", dir, outputfile, exit_lookup_op);
-
-  snprintf(filename_false_lookup,
-           strlen(dir) + strlen(outputfile) + strlen(false_lookup_op) + 1,
-           "%s%s%s", dir, outputfile, false_lookup_op);
-  snprintf(filename_remove,
-           strlen(dir) + strlen(outputfile) + strlen(remove_op) + 1, "%s%s%s",
-           dir, outputfile, remove_op);
-
-  fp_insert = fopen(filename_insert, "w");
-  fp_exit_lookup = fopen(filename_exit_lookup, "w");
-  fp_false_lookup = fopen(filename_false_lookup, "w");
-  fp_remove = fopen(filename_remove, "w");
-
-	if (fp_insert == NULL || fp_exit_lookup == NULL || fp_false_lookup == NULL
-			|| fp_remove == NULL) {
-    printf("Can't open the data file");
-    exit(1);
-  }
-
-  fprintf(fp_insert, "x_0");
-  for (run = 0; run < nruns; run++) {
-    fprintf(fp_insert, "    y_%d", run);
-  }
-  fprintf(fp_insert, "\n");
-
-  fprintf(fp_exit_lookup, "x_0");
-  for (run = 0; run < nruns; run++) {
-    fprintf(fp_exit_lookup, "    y_%d", run);
+  for (int op = 0; op < NUM_OPS; op++)
+    snprintf(filename[op], sizeof(filename[op]), "%s%s%s", dir, outputfile,
+             op_suffixes[op]);
+  snprintf(filename_latency, sizeof(filename_latency), "%s%s%s", dir,
+           outputfile, latency_op);
+  snprintf(filename_points, sizeof(filename_points), "%s%s%s", dir,
+           outputfile, points_op);
+
+  /* Fail before the runs rather than after them */
+  for (int op = 0; op < NUM_OPS; op++) {
+    if (op == OP_REMOVE && filter_ds.remove == NULL)
+      continue;
+    if ((fp = fopen(filename[op], "w")) == NULL) {
+      printf("Can't open the data file %s\n", filename[op]);
+      exit(1);
+    }
+    fclose(fp);
   }
-  fprintf(fp_exit_lookup, "\n");
-
-  fprintf(fp_false_lookup, "x_0");
-  for (run = 0; run < nruns; run++) {
-    fprintf(fp_false_lookup, "    y_%d", run);
+  if ((fp = fopen(filename_points, "w")) == NULL) {
+    printf("Can't open the data file %s\n", filename_points);
+    exit(1);
   }
-  fprintf(fp_false_lookup, "\n");
+  fclose(fp);
 
-	fprintf(fp_remove, "x_0");
-  for (run = 0; run < nruns; run++) {
-    fprintf(fp_remove, "    y_%d", run);
+  /* One row per run, point and operation; latencies in nanoseconds */
+  if ((fp = fopen(filename_latency, "w")) == NULL) {
+    printf("Can't open the data file %s\n", filename_latency);
+    exit(1);
   }
-  fprintf(fp_remove, "\n");
-
-  fclose(fp_insert);
-  fclose(fp_exit_lookup);
-  fclose(fp_false_lookup);
-  fclose(fp_remove);
-
+  fprintf(fp, "run x_0 op samples p50 p90 p99 p99.9 max\n");
+  fclose(fp);
+
+  for (int op = 0; op < NUM_OPS; op++)
+    mops[op] = (double *)calloc((size_t)npoints * nruns, sizeof(double));
+  stats = (point_stats *)calloc((size_t)npoints * nruns, sizeof(point_stats));
+
+  bench_report_config(&report, "program", "bm");
+  bench_report_config(&report, "datastruct", datastruct);
+  bench_report_config(&report, "nslots", nslots);
+  bench_report_config(&report, "load_factor", 1.0 * nvals / nslots);
+  bench_report_config(&report, "tag_shift", VQF_TAG_SHIFT_KERNEL);
+  bench_report_config(&report, "tag_match", VQF_MATCH_KERNEL);
+  bench_report_config(&report, "threads", 1);
+  bench_report_config(&report, "distribution", randmode);
+  if (vals_gen != &uniform_pregen && vals_gen != &uniform_online)
+    bench_report_config(&report, "exponent", skew.exponent);
+  bench_report_config(&report, "points", npoints);
+
+  perf_counters_open(&pc);
   for (run = 0; run < nruns; run++) {
-    fps = 0;
     filter_ds.init(nbits);
 
-    vals_gen_state = vals_gen->init(nvals, filter_ds.range(), NULL);
+    vals_gen_state = vals_gen->init(nvals, filter_ds.range(), &skew);
     old_vals_gen_state = vals_gen->dup(vals_gen_state);
+    alt_vals_gen_state = vals_gen->dup(vals_gen_state);
     remove_vals_gen_state = vals_gen->dup(vals_gen_state);
     sleep(5);
-    othervals_gen_state = othervals_gen->init(nvals, filter_ds.range(), NULL);
-
-    for (exp = 0; exp < 2 * npoints; exp += 2) {
-      fp_insert = fopen(filename_insert, "a");
-      fp_exit_lookup = fopen(filename_exit_lookup, "a");
-      fp_false_lookup = fopen(filename_false_lookup, "a");
-
-      i = (exp / 2) * (nvals / npoints);
-      j = ((exp / 2) + 1) * (nvals / npoints);
-      printf("Round: %d\n", exp / 2);
-
-      gettimeofday(&tv_insert[exp][run], NULL);
-      for (; i < j; i += 1 << 16) {
-        int nitems = j - i < 1 << 16 ? j - i : 1 << 16;
+    othervals_gen_state = othervals_gen->init(nvals, filter_ds.range(), &skew);
+
+    /* Point p inserts keys [p * nvals / npoints, (p + 1) * nvals / npoints)
+     * and is labelled with the load factor after its inserts. */
+    for (point = 0; point < npoints; point++) {
+      point_stats *st = &stats[point * nruns + run];
+      uint64_t first = (uint64_t)point * nvals / npoints;
+      uint64_t last = (uint64_t)(point + 1) * nvals / npoints;
+      uint64_t n = last - first;
+      st->load = 100.0 * last / nslots;
+      st->nitems = n;
+
+      printf("Round: %d\n", point);
+      for (int op = OP_INSERT; op <= OP_FALSE_LOOKUP; op++)
+        latency_reset(&lat[op]);
+
+      perf_counters_start(&pc);
+      gettimeofday(&tv_start, NULL);
+      for (i = first; i < last; i += 1 << 16) {
+        int nitems = last - i < 1 << 16 ? last - i : 1 << 16;
         __uint128_t vals[1 << 16];
         int m;
         assert(vals_gen->gen(vals_gen_state, nitems, vals) == nitems);
 
         for (m = 0; m < nitems; m++) {
-          filter_ds.insert(vals[m]);
+          if (latency_sampled(m, sample_mask)) {
+            uint64_t start = latency_now();
+            st->insert_failures += !filter_ds.insert(vals[m]);
+            latency_record(&lat[OP_INSERT], latency_now() - start);
+          } else {
+            st->insert_failures += !filter_ds.insert(vals[m]);
+          }
         }
       }
-      gettimeofday(&tv_insert[exp + 1][run], NULL);
-      fprintf(fp_insert, "%d", ((exp / 2) * (100 / npoints)));
-      fprintf(fp_insert, " %f\n",
-               1.0 * (nvals / npoints) /
-                  (tv2usec(tv_insert[exp + 1][run]) -
-                   tv2usec(tv_insert[exp][run])));
-
-      i = (exp / 2) * (nvals / 20);
-      gettimeofday(&tv_exit_lookup[exp][run], NULL);
-      for (; i < j; i += 1 << 16) {
-        int nitems = j - i < 1 << 16 ? j - i : 1 << 16;
+      gettimeofday(&tv_end, NULL);
+      perf_counters_stop(&pc);
+      perf_counters_print(stdout, &pc, "Insert", n);
+      mops[OP_INSERT][point * nruns + run] =
+          1.0 * n / (tv2usec(tv_end) - tv2usec(tv_start));
+
+      perf_counters_start(&pc);
+      gettimeofday(&tv_start, NULL);
+      for (i = first; i < last; i += 1 << 16) {
+        int nitems = last - i < 1 << 16 ? last - i : 1 << 16;
         __uint128_t vals[1 << 16];
         int m;
         assert(vals_gen->gen(old_vals_gen_state, nitems, vals) == nitems);
         for (m = 0; m < nitems; m++) {
-          if (!filter_ds.lookup(vals[m])) {
-            // fprintf(stderr, "Failed lookup for 0x%lx%016lx\n",
-            //(uint64_t)(vals[m] >> 64),
-            //(uint64_t)(vals[m] & 0xffffffffffffffff));
-            // abort();
+          int found;
+          if (latency_sampled(m, sample_mask)) {
+            uint64_t start = latency_now();
+            found = filter_ds.lookup(vals[m]);
+            latency_record(&lat[OP_EXIT_LOOKUP], latency_now() - start);
+          } else {
+            found = filter_ds.lookup(vals[m]);
           }
+          st->missed += !found;
         }
       }
-      gettimeofday(&tv_exit_lookup[exp + 1][run], NULL);
-      fprintf(fp_exit_lookup, "%d", ((exp / 2) * (100 / npoints)));
-      fprintf(fp_exit_lookup, " %f\n",
-              1.0 * (nvals / npoints) /
-                  (tv2usec(tv_exit_lookup[exp + 1][run]) -
-                   tv2usec(tv_exit_lookup[exp][run])));
-
-      i = (exp / 2) * (nvals / 20);
-      gettimeofday(&tv_false_lookup[exp][run], NULL);
-      for (; i < j; i += 1 << 16) {
-        int nitems = j - i < 1 << 16 ? j - i : 1 << 16;
+      gettimeofday(&tv_end, NULL);
+      perf_counters_stop(&pc);
+      perf_counters_print(stdout, &pc, "Exists lookup", n);
+      mops[OP_EXIT_LOOKUP][point * nruns + run] =
+          1.0 * n / (tv2usec(tv_end) - tv2usec(tv_start));
+
+      perf_counters_start(&pc);
+      gettimeofday(&tv_start, NULL);
+      for (i = first; i < last; i += 1 << 16) {
+        int nitems = last - i < 1 << 16 ? last - i : 1 << 16;
         __uint128_t othervals[1 << 16];
         int m;
         assert(othervals_gen->gen(othervals_gen_state, nitems, othervals) ==
                nitems);
         for (m = 0; m < nitems; m++) {
-          fps += filter_ds.lookup(othervals[m]);
+          if (latency_sampled(m, sample_mask)) {
+            uint64_t start = latency_now();
+            st->fps += filter_ds.lookup(othervals[m]);
+            latency_record(&lat[OP_FALSE_LOOKUP], latency_now() - start);
+          } else {
+            st->fps += filter_ds.lookup(othervals[m]);
+          }
         }
       }
-      gettimeofday(&tv_false_lookup[exp + 1][run], NULL);
-      fprintf(fp_false_lookup, "%d", ((exp / 2) * (100 / npoints)));
-      fprintf(fp_false_lookup, " %f\n",
-              1.0 * (nvals / npoints) /
-                  (tv2usec(tv_false_lookup[exp + 1][run]) -
-                   tv2usec(tv_false_lookup[exp][run])));
-
-      fclose(fp_insert);
-      fclose(fp_exit_lookup);
-      fclose(fp_false_lookup);
+      gettimeofday(&tv_end, NULL);
+      perf_counters_stop(&pc);
+      perf_counters_print(stdout, &pc, "False lookup", n);
+      mops[OP_FALSE_LOOKUP][point * nruns + run] =
+          1.0 * n / (tv2usec(tv_end) - tv2usec(tv_start));
+
+      /* Untimed: how many of this point's keys went to their second choice */
+      for (i = first; i < last; i += 1 << 16) {
+        int nitems = last - i < 1 << 16 ? last - i : 1 << 16;
+        __uint128_t vals[1 << 16];
+        int m;
+        assert(vals_gen->gen(alt_vals_gen_state, nitems, vals) == nitems);
+        if (filter_ds.alt_lookup == NULL)
+          continue;
+        for (m = 0; m < nitems; m++)
+          st->in_alt += filter_ds.alt_lookup(vals[m]);
+      }
+
+      st->bits_per_item = 8.0 * filter_ds.bytes() / last;
+      printf("Load %.2f%%: %.2f bits/item, failed inserts %lu, missed %lu, "
+             "FP rate %f",
+             st->load, st->bits_per_item, st->insert_failures, st->missed,
+             1.0 * st->fps / n);
+      if (filter_ds.alt_lookup != NULL)
+        printf(", alternate block %.2f%%", 100.0 * st->in_alt / n);
+      printf("\n");
+
+      latency_print_header(stdout, "latency (ns)");
+      for (int op = OP_INSERT; op <= OP_FALSE_LOOKUP; op++)
+        print_latency_point(filename_latency, run, st->load, op_names[op],
+                            &lat[op]);
     }
 
-    for (exp = 0; exp < 2 * npoints; exp += 2) {
-       fp_remove = fopen(filename_remove, "a");
-       i = (exp / 2) * (nvals / npoints);
-       j = ((exp / 2) + 1) * (nvals / npoints);
-       printf("Round: %d\n", exp / 2);
-
-       gettimeofday(&tv_remove[exp][run], NULL);
-       for (; i < j; i += 1 << 16) {
-          int nitems = j - i < 1 << 16 ? j - i : 1 << 16;
-          __uint128_t vals[1 << 16];
-          int m;
-          assert(vals_gen->gen(remove_vals_gen_state, nitems, vals) == nitems);
-
-          for (m = 0; m < nitems; m++) {
-             filter_ds.remove(vals[m]);
-          }
-       }
-       gettimeofday(&tv_remove[exp + 1][run], NULL);
-       fprintf(fp_remove, "%d", ((exp / 2) * (100 / npoints)));
-       fprintf(fp_remove, " %f\n",
-             1.0 * (nvals / npoints) /
-             (tv2usec(tv_remove[exp + 1][run]) -
-              tv2usec(tv_remove[exp][run])));
+    bytes = filter_ds.bytes();
+    if (filter_ds.print_stats != NULL)
+      filter_ds.print_stats(stdout);
+
+    /* Point p removes the keys point p inserted, oldest first, and is
+     * labelled with the load factor before its removes. */
+    for (point = 0; filter_ds.remove != NULL && point < npoints; point++) {
+      uint64_t first = (uint64_t)point * nvals / npoints;
+      uint64_t last = (uint64_t)(point + 1) * nvals / npoints;
+      double load = 100.0 * (nvals - first) / nslots;
+      printf("Round: %d\n", point);
+      latency_reset(&lat[OP_REMOVE]);
+
+      perf_counters_start(&pc);
+      gettimeofday(&tv_start, NULL);
+      for (i = first; i < last; i += 1 << 16) {
+        int nitems = last - i < 1 << 16 ? last - i : 1 << 16;
+        __uint128_t vals[1 << 16];
+        int m;
+        assert(vals_gen->gen(remove_vals_gen_state, nitems, vals) == nitems);
 
-       fclose(fp_remove);
-   }
+        for (m = 0; m < nitems; m++) {
+          if (latency_sampled(m, sample_mask)) {
+            uint64_t start = latency_now();
+            filter_ds.remove(vals[m]);
+            latency_record(&lat[OP_REMOVE], latency_now() - start);
+          } else {
+            filter_ds.remove(vals[m]);
+          }
+        }
+      }
+      gettimeofday(&tv_end, NULL);
+      perf_counters_stop(&pc);
+      perf_counters_print(stdout, &pc, "Remove", last - first);
+      mops[OP_REMOVE][point * nruns + run] =
+          1.0 * (last - first) / (tv2usec(tv_end) - tv2usec(tv_start));
+
+      latency_print_header(stdout, "latency (ns)");
+      print_latency_point(filename_latency, run, load, op_names[OP_REMOVE],
+                          &lat[OP_REMOVE]);
+    }
 
     filter_ds.destroy();
   }
-  printf("Insert Performance written to file: %s\n", filename_insert);
-  printf("Exist lookup Performance written to file: %s\n", filename_exit_lookup);
-  printf("False lookup Performance written to file: %s\n", filename_false_lookup);
-  printf("Remove Performance written to file: %s\n", filename_remove);
+  perf_counters_close(&pc);
+
+  /* One row per point and one column per run */
+  for (int op = 0; op < NUM_OPS; op++) {
+    if (op == OP_REMOVE && filter_ds.remove == NULL)
+      continue;
+    fp = fopen(filename[op], "w");
+    fprintf(fp, "x_0");
+    for (run = 0; run < nruns; run++)
+      fprintf(fp, "    y_%d", run);
+    fprintf(fp, "\n");
+    for (point = 0; point < npoints; point++) {
+      double load = op == OP_REMOVE
+                        ? 100.0 * (nvals - (uint64_t)point * nvals / npoints) / nslots
+                        : stats[point * nruns].load;
+      fprintf(fp, "%.2f", load);
+      for (run = 0; run < nruns; run++) {
+        fprintf(fp, " %f", mops[op][point * nruns + run]);
+        bench_report_add(&report, op_names[op], load, "Mops/s",
+                         mops[op][point * nruns + run]);
+      }
+      fprintf(fp, "\n");
+    }
+    fclose(fp);
+    printf("%c%s Performance written to file: %s\n", toupper(op_names[op][0]),
+           op_names[op] + 1, filename[op]);
+  }
 
-  printf("FP rate: %f (%lu/%lu)\n", 1.0 * fps / nvals, fps, nvals);
+  uint64_t insert_failures = 0, missed = 0, fps = 0;
+  fp = fopen(filename_points, "w");
+  fprintf(fp, "run x_0 items insert_failures missed false_positives fp_rate "
+              "alt_block alt_fraction bits_per_item\n");
+  for (run = 0; run < nruns; run++) {
+    for (point = 0; point < npoints; point++) {
+      point_stats *st = &stats[point * nruns + run];
+      fprintf(fp, "%u %.2f %lu %lu %lu %lu %f %lu %f %.3f\n", run, st->load,
+              st->nitems, st->insert_failures, st->missed, st->fps,
+              1.0 * st->fps / st->nitems, st->in_alt,
+              1.0 * st->in_alt / st->nitems, st->bits_per_item);
+      insert_failures += st->insert_failures;
+      missed += st->missed;
+      fps += st->fps;
+    }
+  }
+  fclose(fp);
+  printf("Per-point FP rate, insert failures, alternate-block use and space written to file: %s\n",
+         filename_points);
+  printf("Latency percentiles written to file: %s\n", filename_latency);
+
+  printf("Distribution: %s", randmode);
+  if (vals_gen != &uniform_pregen && vals_gen != &uniform_online)
+    printf(" (exponent %.2f)", skew.exponent);
+  printf("\n");
+  printf("Failed inserts: %lu/%lu\n", insert_failures, (uint64_t)nvals * nruns);
+  printf("Missed lookups: %lu/%lu\n", missed, (uint64_t)nvals * nruns);
+  printf("FP rate: %f (%lu/%lu)\n", 1.0 * fps / (nvals * nruns), fps,
+         (uint64_t)nvals * nruns);
+  printf("Space: %lu bytes, %.2f bits/item at %.2f%% load\n", bytes,
+         8.0 * bytes / nvals, 100.0 * nvals / nslots);
+  bench_report_config(&report, "bytes", bytes);
+  if (resultfile) {
+    if (!bench_report_write(&report, resultfile))
+      exit(1);
+    printf("Results written to file: %s\n", resultfile);
+  }
 
   return 0;
 }
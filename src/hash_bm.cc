@@ -0,0 +1,342 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  hash_bm.cc
+ *
+ *    Description:  How the caller's hash and its reduction to the filter's
+ *                  range affect balance and speed. Structured inputs
+ *                  (sequential integers, k-mers of a synthetic genome and
+ *                  clustered ids) go through each candidate hash and range
+ *                  reduction into a fresh filter. For each combination it
+ *                  reports:
+ *
+ *                  - hash and reduce throughput alone, and with the inserts
+ *                    up to load factor 0.85;
+ *                  - the spread of free slots per block at 0.85, and the share
+ *                    of blocks near full;
+ *                  - the share of keys whose alternate block (from
+ *                    alt_block_index) is their primary block, which leaves
+ *                    them a single choice;
+ *                  - the load factor at the first failed insert.
+ *
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <nmmintrin.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "vqf_filter.h"
+#include "vqf_inline.h"
+#include "zipf.h"
+#include "bench_report.h"
+
+#define FILL_LOAD 0.85
+#define KMER_REPEAT_LENGTH 1000
+#define CLUSTER_SIZE 1024
+
+static uint64_t now_nsec(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+// Candidate hashes
+
+static inline uint64_t hash_identity(uint64_t x) {
+   return x;
+}
+
+// Fibonacci multiplicative hashing: one multiply, good high bits only
+static inline uint64_t hash_multiply(uint64_t x) {
+   return x * 0x9e3779b97f4a7c15ULL;
+}
+
+// The MurmurHash3 64-bit finalizer
+static inline uint64_t hash_fmix64(uint64_t x) {
+   x ^= x >> 33;
+   x *= 0xff51afd7ed558ccdULL;
+   x ^= x >> 33;
+   x *= 0xc4ceb9fe1a85ec53ULL;
+   return x ^ (x >> 33);
+}
+
+static inline uint64_t hash_splitmix64(uint64_t x) {
+   return mix64(x);
+}
+
+// Two hardware CRC32C lanes with different seeds
+static inline uint64_t hash_crc32c(uint64_t x) {
+   return (uint64_t)_mm_crc32_u64(0, x) << 32 | _mm_crc32_u64(0x9e3779b9, x);
+}
+
+// Range reductions
+
+static inline uint64_t reduce_modulo(uint64_t h, uint64_t range) {
+   return h % range;
+}
+
+// Lemire's multiply-shift: the high word of h * range, no division
+static inline uint64_t reduce_multiply(uint64_t h, uint64_t range) {
+   return (uint64_t)(((__uint128_t)h * range) >> 64);
+}
+
+// Inputs
+
+// 0, 1, 2, ...
+static void gen_sequential(std::vector<uint64_t>& keys, uint64_t n, uint64_t seed) {
+   keys.resize(n);
+   for (uint64_t i = 0; i < n; i++)
+      keys[i] = i;
+}
+
+// The 2-bit packed k-mers of a random genome in which every tenth segment
+// of KMER_REPEAT_LENGTH bases repeats an earlier one, so some k-mers recur.
+static void gen_kmers(std::vector<uint64_t>& keys, uint64_t n, uint64_t seed, uint32_t k) {
+   uint64_t length = n + k - 1;
+   std::vector<uint8_t> genome(length);
+   uint64_t bits = 0;
+   for (uint64_t i = 0; i < length; i++) {
+      if (i % 32 == 0)
+         bits = mix64(seed + i);
+      genome[i] = bits & 3;
+      bits >>= 2;
+   }
+   for (uint64_t s = 10; (s + 1) * KMER_REPEAT_LENGTH <= length; s += 10) {
+      uint64_t from = mix64(seed ^ s) % s * KMER_REPEAT_LENGTH;
+      memcpy(&genome[s * KMER_REPEAT_LENGTH], &genome[from], KMER_REPEAT_LENGTH);
+   }
+   uint64_t mask = k < 32 ? (1ULL << (2 * k)) - 1 : UINT64_MAX, kmer = 0;
+   keys.resize(n);
+   for (uint64_t i = 0; i < length; i++) {
+      kmer = ((kmer << 2) | genome[i]) & mask;
+      if (i + 1 >= k)
+         keys[i + 1 - k] = kmer;
+   }
+}
+
+// Runs of CLUSTER_SIZE consecutive ids starting at random bases, as when ids
+// are handed out in batches.
+static void gen_clustered(std::vector<uint64_t>& keys, uint64_t n, uint64_t seed) {
+   keys.resize(n);
+   for (uint64_t i = 0; i < n; i++)
+      keys[i] = mix64(seed ^ (i / CLUSTER_SIZE)) + i % CLUSTER_SIZE;
+}
+
+typedef struct combo_result {
+   double hash_mops;
+   double insert_mops;
+   double stddev_free;
+   double near_full;          // percent of blocks
+   double same_block;         // percent of keys
+   double first_failure;      // load factor, or -1 if none
+} combo_result;
+
+// keeps the hash-only loop from being optimized away
+static volatile uint64_t hash_sink;
+
+static inline void note_failure(vqf_filter *filter, combo_result *res) {
+   if (res->first_failure < 0)
+      res->first_failure = 1.0 * vqf_size(filter) / filter->metadata.nslots;
+}
+
+template <uint64_t (*Hash)(uint64_t), uint64_t (*Reduce)(uint64_t, uint64_t)>
+static void run_combo(const std::vector<uint64_t>& keys, uint64_t qbits, combo_result *res) {
+   vqf_filter *filter;
+   if ((filter = vqf_init(1ULL << qbits)) == NULL) {
+      fprintf(stderr, "Can't allocate vqf filter.");
+      exit(EXIT_FAILURE);
+   }
+   vqf::view v = vqf::make_view(filter);
+   uint64_t nslots = filter->metadata.nslots, range = filter->metadata.range;
+   uint64_t nfill = std::min<uint64_t>(FILL_LOAD * nslots, keys.size());
+
+   uint64_t sum = 0, start = now_nsec();
+   for (uint64_t i = 0; i < nfill; i++)
+      sum += Reduce(Hash(keys[i]), range);
+   uint64_t end = now_nsec();
+   hash_sink = sum;
+   res->hash_mops = 1000.0 * nfill / std::max<uint64_t>(end - start, 1);
+
+   res->first_failure = -1;
+   start = now_nsec();
+   for (uint64_t i = 0; i < nfill; i++)
+      if (!vqf::insert(v, Reduce(Hash(keys[i]), range)))
+         note_failure(filter, res);
+   end = now_nsec();
+   res->insert_mops = 1000.0 * nfill / std::max<uint64_t>(end - start, 1);
+
+   vqf_occupancy occupancy;
+   vqf_get_occupancy(filter, 0, &occupancy, NULL, 0);
+   res->stddev_free = occupancy.stddev_free;
+   res->near_full = 100.0 * occupancy.near_full_blocks / occupancy.nblocks;
+
+   uint64_t same = 0;
+   for (uint64_t i = 0; i < nfill; i++) {
+      uint64_t h = Reduce(Hash(keys[i]), range);
+      same += (h >> v.key_remainder_bits) / QUQU_BUCKETS_PER_BLOCK ==
+         vqf::alt_block_index(v, h, h & TAG_MASK) / QUQU_BUCKETS_PER_BLOCK;
+   }
+   res->same_block = 100.0 * same / std::max<uint64_t>(nfill, 1);
+
+   for (uint64_t i = nfill; i < keys.size() && res->first_failure < 0; i++)
+      if (!vqf::insert(v, Reduce(Hash(keys[i]), range)))
+         note_failure(filter, res);
+   free(filter);
+}
+
+typedef void (*combo_fn)(const std::vector<uint64_t>&, uint64_t, combo_result *);
+
+typedef struct combo {
+   const char *hash;
+   const char *reduce;
+   combo_fn run;
+} combo;
+
+#define COMBOS(name, hash) \
+   {name, "modulo", run_combo<hash, reduce_modulo>}, \
+   {name, "multiply", run_combo<hash, reduce_multiply>}
+
+static const combo combos[] = {
+   COMBOS("identity", hash_identity),
+   COMBOS("multiply", hash_multiply),
+   COMBOS("fmix64", hash_fmix64),
+   COMBOS("splitmix64", hash_splitmix64),
+   COMBOS("crc32c", hash_crc32c),
+};
+
+static const char *input_names[] = {"sequential", "kmers", "clustered"};
+#define NUM_INPUTS 3
+
+static double median(std::vector<double> values) {
+   std::sort(values.begin(), values.end());
+   return values[values.size() / 2];
+}
+
+static void usage(const char *name) {
+   printf("%s [OPTIONS]\n"
+         "Options are:\n"
+         "  -n qbits       [ log_2 of filter capacity.  Default 22 ]\n"
+         "  -i input       [ sequential, kmers or clustered.  Default all three ]\n"
+         "  -k k           [ k-mer length, at most 32.  Default 21 ]\n"
+         "  -r nruns       [ runs of each combination; throughput is the median.\n"
+         "                   Default 3 ]\n"
+         "  -j resultfile  [ write the configuration, throughput and load at the first\n"
+         "                   failure as JSON, or CSV if it ends in .csv ]\n",
+         name);
+}
+
+int main(int argc, char **argv)
+{
+   uint64_t qbits = 22, nruns = 3;
+   uint32_t k = 21;
+   int only = -1;
+   const char *resultfile = NULL;
+   int opt;
+   char *term = NULL;
+
+   while ((opt = getopt(argc, argv, "n:i:k:r:j:")) != -1) {
+      switch (opt) {
+         case 'n':
+            qbits = strtoull(optarg, &term, 10);
+            break;
+         case 'i':
+            for (int i = 0; i < NUM_INPUTS; i++)
+               if (strcmp(optarg, input_names[i]) == 0)
+                  only = i;
+            if (only < 0)
+               term = optarg;
+            break;
+         case 'k':
+            k = strtoul(optarg, &term, 10);
+            break;
+         case 'r':
+            nruns = strtoull(optarg, &term, 10);
+            break;
+         case 'j':
+            resultfile = optarg;
+            break;
+         default:
+            usage(argv[0]);
+            exit(1);
+      }
+      if (term != NULL && *term) {
+         fprintf(stderr, "Invalid argument to -%c: %s\n", opt, optarg);
+         usage(argv[0]);
+         exit(1);
+      }
+      term = NULL;
+   }
+   if (nruns == 0 || k == 0 || k > 32) {
+      usage(argv[0]);
+      exit(1);
+   }
+
+   // enough keys to fill every slot, so each combination runs into a failure
+   uint64_t nkeys = (1ULL << qbits) + QUQU_SLOTS_PER_BLOCK;
+   uint64_t seed = 0x5eed;
+   bench_report report;
+   bench_report_config(&report, "program", "hash_bm");
+   bench_report_config(&report, "nslots", 1ULL << qbits);
+   bench_report_config(&report, "load_factor", FILL_LOAD);
+   bench_report_config(&report, "tag_shift", VQF_TAG_SHIFT_KERNEL);
+   bench_report_config(&report, "tag_match", VQF_MATCH_KERNEL);
+   bench_report_config(&report, "kmer_length", k);
+   printf("Filter kernels: %s tag shift, %s match\n", VQF_TAG_SHIFT_KERNEL, VQF_MATCH_KERNEL);
+
+   std::vector<uint64_t> keys;
+   for (int input = 0; input < NUM_INPUTS; input++) {
+      if (only >= 0 && input != only)
+         continue;
+      if (input == 0)
+         gen_sequential(keys, nkeys, seed);
+      else if (input == 1)
+         gen_kmers(keys, nkeys, seed, k);
+      else
+         gen_clustered(keys, nkeys, seed);
+
+      printf("\n%s keys, %lu of them, into 2^%lu slots\n", input_names[input], nkeys, qbits);
+      printf("%-12s %-9s %10s %10s %10s %10s %10s %10s\n", "hash", "reduce", "hash Mops",
+            "ins Mops", "free sd", "nearfull%", "sameblk%", "1st fail");
+      for (size_t c = 0; c < sizeof(combos) / sizeof(combos[0]); c++) {
+         std::vector<double> hash_mops, insert_mops;
+         combo_result res;
+         for (uint64_t run = 0; run < nruns; run++) {
+            combos[c].run(keys, qbits, &res);
+            hash_mops.push_back(res.hash_mops);
+            insert_mops.push_back(res.insert_mops);
+         }
+         printf("%-12s %-9s %10.2f %10.2f %10.2f %10.2f %10.3f ", combos[c].hash,
+               combos[c].reduce, median(hash_mops), median(insert_mops), res.stddev_free,
+               res.near_full, res.same_block);
+         if (res.first_failure < 0)
+            printf("%10s\n", "none");
+         else
+            printf("%10.4f\n", res.first_failure);
+
+         std::string phase = std::string(input_names[input]) + "/" + combos[c].hash + "/" +
+            combos[c].reduce;
+         for (uint64_t run = 0; run < nruns; run++)
+            bench_report_add(&report, phase.c_str(), 100 * FILL_LOAD, "Mops/s", insert_mops[run]);
+         if (res.first_failure >= 0)
+            bench_report_add(&report, (phase + "/first_failure").c_str(), 0, "load %",
+                  100 * res.first_failure);
+      }
+   }
+   printf("\nfree sd: standard deviation of free slots per block at load %.2f; nearfull: "
+         "blocks full or within %d slots of it;\nsameblk: keys whose alternate block is their "
+         "primary; 1st fail: load factor at the first failed insert\n",
+         FILL_LOAD, VQF_NEAR_FULL_SLOTS);
+
+   if (resultfile && !bench_report_write(&report, resultfile))
+      exit(EXIT_FAILURE);
+   return 0;
+}
@@ -0,0 +1,457 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  kernel_bm.cc
+ *
+ *    Description:  Microbenchmarks for the block kernels in vqf_inline.h.
+ *                  Every kernel runs on L1-resident blocks and operands, so
+ *                  the numbers show the cost of the kernel and not of memory.
+ *
+ *                  Each measurement is taken on a pinned core after a warmup
+ *                  pass, and is the median of REPS runs of NOPS operations.
+ *                  Cycles are TSC ticks read with rdtscp; on CPUs whose core
+ *                  clock differs from the TSC they scale with the ratio.
+ *
+ *                  Usage: kernel_bm [core]   (default: the current core)
+ *
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+
+#include "vqf_inline.h"
+
+#define NOPS (1ULL << 20)
+#define REPS 15
+// operand streams are cycled through so they stay in L1
+#define NLANES (1 << 12)
+// number of tags kept in the block while the shift kernels run
+#define FILL 20
+
+typedef void (*update_kernel)(vqf_interleaved_block * restrict block, uint8_t index, uint16_t tag);
+typedef void (*remove_kernel)(vqf_interleaved_block * restrict block, uint8_t index);
+
+typedef struct shift_kernel {
+   const char *name;
+   update_kernel update;
+   remove_kernel remove;
+} shift_kernel;
+
+static const shift_kernel shift_kernels[] = {
+   {"scalar", vqf::update_tags_scalar, vqf::remove_tags_scalar},
+#ifdef __AVX512BW__
+   {"avx512-permute", vqf::update_tags_512_permute, vqf::remove_tags_512_permute},
+#endif
+#ifdef __AVX512VBMI2__
+   {"avx512-vbmi2", vqf::update_tags_512_expand, vqf::remove_tags_512_expand},
+#endif
+};
+static const int nshift_kernels = sizeof(shift_kernels) / sizeof(shift_kernels[0]);
+
+static uint64_t now_nsec(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+static inline uint64_t now_cycles(void) {
+   unsigned aux;
+   return __rdtscp(&aux);
+}
+
+static bool pin_to_core(int core) {
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   CPU_SET(core, &set);
+   return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+typedef struct timing {
+   double cycles;
+   double nsec;
+} timing;
+
+// Results are summed into sink so the measured loops are not optimized away.
+static volatile uint64_t sink;
+
+// Runs body(n), which performs n operations, once to warm up and then REPS
+// times, and returns the per-operation medians.
+template <typename Body>
+static timing measure(Body body) {
+   double cycles[REPS], nsec[REPS];
+
+   sink += body(NOPS / 8);
+   for (int r = 0; r < REPS; r++) {
+      uint64_t start = now_nsec();
+      uint64_t start_cycles = now_cycles();
+      sink += body(NOPS);
+      uint64_t end_cycles = now_cycles();
+      uint64_t end = now_nsec();
+      cycles[r] = 1.0 * (end_cycles - start_cycles) / NOPS;
+      nsec[r] = 1.0 * (end - start) / NOPS;
+   }
+   std::sort(cycles, cycles + REPS);
+   std::sort(nsec, nsec + REPS);
+   timing t = {cycles[REPS / 2], nsec[REPS / 2]};
+   return t;
+}
+
+static void report(const char *name, timing t) {
+   printf("  %-16s %8.2f cycles/op %8.2f nanoseconds/op\n", name, t.cycles, t.nsec);
+}
+
+static void init_block(vqf_interleaved_block *block) {
+   block->md = 0;
+   for (int i = 0; i < QUQU_SLOTS_PER_BLOCK; i++)
+      block->tags[i] = i < FILL ? rand() & 0xffff : 0;
+}
+
+static void init_block(vqf_split_block *block) {
+   block->md = 0;
+   for (int i = 0; i < QUQU_SLOTS_PER_BLOCK; i++) {
+      block->tags[i] = i < FILL ? rand() & 0xff : 0;
+      block->vals[i] = i < FILL ? rand() & 0xff : 0;
+   }
+}
+
+// Slot lanes for one insert followed by one remove, so the fill stays at FILL.
+static uint8_t insert_lanes[NLANES];
+static uint8_t remove_lanes[NLANES];
+
+static void gen_shift_lanes(void) {
+   for (int i = 0; i < NLANES; i++) {
+      insert_lanes[i] = sizeof(uint64_t)/2 + rand() % (FILL + 1);
+      remove_lanes[i] = sizeof(uint64_t)/2 + rand() % (FILL + 1);
+   }
+}
+
+// Every kernel must leave the block exactly as the scalar kernel does.
+static bool verify_shift_kernels(void) {
+   vqf_interleaved_block blocks[nshift_kernels];
+   srand(1);
+   init_block(&blocks[0]);
+   for (int k = 1; k < nshift_kernels; k++)
+      blocks[k] = blocks[0];
+
+   for (uint64_t i = 0; i < (1 << 16); i++) {
+      uint16_t tag = insert_lanes[i % NLANES] * 257 + i;
+      for (int k = 0; k < nshift_kernels; k++) {
+         shift_kernels[k].update(&blocks[k], insert_lanes[i % NLANES], tag);
+         shift_kernels[k].remove(&blocks[k], remove_lanes[i % NLANES]);
+      }
+      for (int k = 1; k < nshift_kernels; k++) {
+         if (memcmp(&blocks[0], &blocks[k], sizeof(blocks[0])) != 0) {
+            fprintf(stderr, "%s differs from %s after %lu operations\n",
+                  shift_kernels[k].name, shift_kernels[0].name, i + 1);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+// The split-layout kernels must agree with each other, and with the
+// interleaved scalar kernel once the two layouts are zipped together.
+static bool verify_split_kernels(void) {
+   vqf_interleaved_block interleaved;
+   vqf_split_block scalar;
+   srand(1);
+   init_block(&scalar);
+   interleaved.md = scalar.md;
+   for (int i = 0; i < QUQU_SLOTS_PER_BLOCK; i++)
+      interleaved.tags[i] = scalar.vals[i] << 8 | scalar.tags[i];
+#ifdef __AVX512VBMI__
+   vqf_split_block vector = scalar;
+#endif
+
+   for (uint64_t i = 0; i < (1 << 16); i++) {
+      uint8_t insert_lane = insert_lanes[i % NLANES], remove_lane = remove_lanes[i % NLANES];
+      uint16_t tag = insert_lane * 257 + i;
+      vqf::update_tags_scalar(&interleaved, insert_lane, tag);
+      vqf::remove_tags_scalar(&interleaved, remove_lane);
+      vqf::update_tags_split_scalar(&scalar, insert_lane, tag);
+      vqf::remove_tags_split_scalar(&scalar, remove_lane);
+#ifdef __AVX512VBMI__
+      vqf::update_tags_split_512(&vector, insert_lane, tag);
+      vqf::remove_tags_split_512(&vector, remove_lane);
+      if (memcmp(&scalar, &vector, sizeof(scalar)) != 0) {
+         fprintf(stderr, "split-vbmi differs from split-scalar after %lu operations\n", i + 1);
+         return false;
+      }
+#endif
+      for (int j = 0; j < QUQU_SLOTS_PER_BLOCK; j++) {
+         if (interleaved.tags[j] != (scalar.vals[j] << 8 | scalar.tags[j])) {
+            fprintf(stderr, "split-scalar differs from scalar after %lu operations\n", i + 1);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+template <typename Block, void (*update)(Block * restrict, uint8_t, uint16_t),
+         void (*remove)(Block * restrict, uint8_t)>
+static timing bench_shift(void) {
+   alignas(64) static Block block;
+   init_block(&block);
+
+   return measure([](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+         update(&block, insert_lanes[i % NLANES], i);
+         remove(&block, remove_lanes[i % NLANES]);
+      }
+      return (uint64_t)block.tags[0];
+   });
+}
+
+// Metadata words shaped like a block's: QUQU_SLOTS_PER_BLOCK 0s spread over
+// 64 bits, with a bucket rank and a bit index to operate on.
+#define NMD (1 << 12)
+static uint64_t md_words[NMD];
+static uint8_t md_ranks[NMD];
+static uint8_t md_indexes[NMD];
+
+static void gen_md_words(void) {
+   for (int i = 0; i < NMD; i++) {
+      uint64_t md = UINT64_MAX;
+      for (int zeros = 0; zeros < QUQU_SLOTS_PER_BLOCK; ) {
+         uint64_t bit = 1ULL << (rand() % 64);
+         if (md & bit) {
+            md &= ~bit;
+            zeros++;
+         }
+      }
+      md_words[i] = md;
+      md_ranks[i] = rand() % QUQU_BUCKETS_PER_BLOCK;
+      md_indexes[i] = rand() % 64;
+   }
+}
+
+static bool verify_md_kernels(void) {
+   for (int i = 0; i < NMD; i++) {
+      uint64_t md = md_words[i];
+      for (int rank = 0; rank < 64; rank++) {
+         if (vqf::word_select_pdep(md, rank) != vqf::word_select_broadword(md, rank) ||
+               vqf::lookup_64_pdep(md, rank % 36) != vqf::lookup_64_broadword(md, rank % 36)) {
+            fprintf(stderr, "broadword select differs for %lx rank %d\n", md, rank);
+            return false;
+         }
+         uint64_t a = md, b = md, c = md, d = md;
+         vqf::update_md_pdep(&a, rank);
+         vqf::update_md_broadword(&b, rank);
+         vqf::remove_md_pdep(&c, rank);
+         vqf::remove_md_broadword(&d, rank);
+         if (a != b || c != d) {
+            fprintf(stderr, "broadword metadata shift differs for %lx index %d\n", md, rank);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+template <typename Result, Result (*lookup)(uint64_t, uint64_t)>
+static timing bench_lookup(void) {
+   return measure([](uint64_t n) {
+      uint64_t sum = 0;
+      for (uint64_t i = 0; i < n; i++)
+         sum += lookup(md_words[i % NMD], md_ranks[i % NMD]);
+      return sum;
+   });
+}
+
+template <void (*shift)(uint64_t *, uint8_t)>
+static timing bench_md(void) {
+   return measure([](uint64_t n) {
+      uint64_t sum = 0;
+      for (uint64_t i = 0; i < n; i++) {
+         uint64_t md = md_words[i % NMD];
+         shift(&md, md_indexes[i % NMD]);
+         sum += md;
+      }
+      return sum;
+   });
+}
+
+template <void (*update)(uint64_t *, uint8_t), void (*remove)(uint64_t *, uint8_t)>
+static timing bench_md_shift(void) {
+   return measure([](uint64_t n) {
+      uint64_t sum = 0;
+      for (uint64_t i = 0; i < n; i++) {
+         uint64_t md = md_words[i % NMD];
+         update(&md, md_indexes[i % NMD]);
+         remove(&md, md_indexes[(i + 1) % NMD]);
+         sum += md;
+      }
+      return sum;
+   });
+}
+
+// Blocks with random tags and probe tags, half of which are present.
+#define NPROBES (1 << 8)
+static vqf_interleaved_block probe_blocks[NPROBES];
+static vqf_split_block split_probe_blocks[NPROBES];
+static uint8_t probe_tags[NPROBES];
+// Blocks of the configured layout for generate_match_mask, with real
+// metadata so each probe covers a run of its bucket.
+alignas(64) static vqf_block filter_blocks[NPROBES];
+static uint64_t probe_buckets[NPROBES];
+
+// The split blocks hold the same slots as the interleaved ones.
+static void gen_probes(void) {
+   for (int i = 0; i < NPROBES; i++) {
+      probe_blocks[i].md = UINT64_MAX;
+      split_probe_blocks[i].md = UINT64_MAX;
+      for (int j = 0; j < QUQU_SLOTS_PER_BLOCK; j++) {
+         probe_blocks[i].tags[j] = rand() & 0xffff;
+         split_probe_blocks[i].tags[j] = probe_blocks[i].tags[j] & 0xff;
+         split_probe_blocks[i].vals[j] = probe_blocks[i].tags[j] >> 8;
+      }
+      probe_tags[i] = rand() % 2 ? probe_blocks[i].tags[rand() % QUQU_SLOTS_PER_BLOCK] : rand();
+
+      filter_blocks[i].md = md_words[i];
+      for (int j = 0; j < QUQU_SLOTS_PER_BLOCK; j++)
+         vqf::update_tags_512(&filter_blocks[i], j + sizeof(uint64_t)/2, probe_blocks[i].tags[j]);
+      probe_buckets[i] = i * QUQU_BUCKETS_PER_BLOCK + md_ranks[i];
+   }
+}
+
+typedef uint32_t (*match_kernel)(const vqf_interleaved_block * restrict block, uint64_t tag);
+typedef uint32_t (*split_match_kernel)(const vqf_split_block * restrict block, uint64_t tag);
+
+static bool verify_match_kernels(void) {
+   for (int i = 0; i < NPROBES; i++) {
+      for (uint64_t tag = 0; tag < 256; tag++) {
+         uint32_t expected = vqf::tag_match_mask_loop(&probe_blocks[i], tag);
+         if (vqf::tag_match_mask_swar(&probe_blocks[i], tag) != expected) {
+            fprintf(stderr, "swar match mask differs for block %d tag %lu\n", i, tag);
+            return false;
+         }
+#ifdef __AVX512BW__
+         if (vqf::tag_match_mask_512(&probe_blocks[i], tag) != expected) {
+            fprintf(stderr, "avx512 match mask differs for block %d tag %lu\n", i, tag);
+            return false;
+         }
+#endif
+         if (vqf::tag_match_mask_split_loop(&split_probe_blocks[i], tag) != expected ||
+               vqf::tag_match_mask_split_swar(&split_probe_blocks[i], tag) != expected) {
+            fprintf(stderr, "split match mask differs for block %d tag %lu\n", i, tag);
+            return false;
+         }
+#ifdef __AVX2__
+         if (vqf::tag_match_mask_split_256(&split_probe_blocks[i], tag) != expected) {
+            fprintf(stderr, "split avx2 match mask differs for block %d tag %lu\n", i, tag);
+            return false;
+         }
+#endif
+         if (vqf::tag_match_mask(&filter_blocks[i], tag) != expected) {
+            fprintf(stderr, "%s match mask differs for block %d tag %lu\n",
+                  VQF_MATCH_KERNEL, i, tag);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+template <match_kernel match>
+static timing bench_match(void) {
+   return measure([](uint64_t n) {
+      uint64_t sum = 0;
+      for (uint64_t i = 0; i < n; i++)
+         sum += match(&probe_blocks[i % NPROBES], probe_tags[i % NPROBES]);
+      return sum;
+   });
+}
+
+template <split_match_kernel match>
+static timing bench_split_match(void) {
+   return measure([](uint64_t n) {
+      uint64_t sum = 0;
+      for (uint64_t i = 0; i < n; i++)
+         sum += match(&split_probe_blocks[i % NPROBES], probe_tags[i % NPROBES]);
+      return sum;
+   });
+}
+
+static timing bench_generate_match_mask(void) {
+   return measure([](uint64_t n) {
+      vqf::view v = {filter_blocks, 0, 0};
+      uint64_t sum = 0;
+      for (uint64_t i = 0; i < n; i++)
+         sum += vqf::generate_match_mask(v, probe_tags[i % NPROBES], probe_buckets[i % NPROBES]);
+      return sum;
+   });
+}
+
+int main(int argc, char **argv)
+{
+   int core = argc > 1 ? atoi(argv[1]) : sched_getcpu();
+   if (pin_to_core(core))
+      printf("Pinned to core %d, median of %d runs of %llu operations\n", core, REPS, NOPS);
+   else
+      fprintf(stderr, "Could not pin to core %d, running unpinned\n", core);
+
+   printf("Filter tag shift kernel: %s, match kernel: %s, slow pdep detected: %s\n",
+         VQF_TAG_SHIFT_KERNEL, VQF_MATCH_KERNEL, vqf::cpu_features<>::slow_pdep ? "yes" : "no");
+
+   gen_shift_lanes();
+   gen_md_words();
+   gen_probes();
+   if (!verify_shift_kernels() || !verify_split_kernels() || !verify_md_kernels() ||
+         !verify_match_kernels())
+      exit(EXIT_FAILURE);
+
+   printf("Filter kernels as dispatched:\n");
+   report("select_64", bench_lookup<int64_t, vqf::select_64>());
+   report("lookup_64", bench_lookup<uint64_t, vqf::lookup_64>());
+   report("update_md", bench_md<vqf::update_md>());
+   report("remove_md", bench_md<vqf::remove_md>());
+   report("update+remove", bench_shift<vqf_block, vqf::update_tags_512, vqf::remove_tags_512>());
+   report("generate_match", bench_generate_match_mask());
+
+   printf("Tag shift, %d of %d slots full (insert + remove):\n", FILL, QUQU_SLOTS_PER_BLOCK);
+   report("scalar", bench_shift<vqf_interleaved_block, vqf::update_tags_scalar, vqf::remove_tags_scalar>());
+#ifdef __AVX512BW__
+   report("avx512-permute",
+         bench_shift<vqf_interleaved_block, vqf::update_tags_512_permute, vqf::remove_tags_512_permute>());
+#endif
+#ifdef __AVX512VBMI2__
+   report("avx512-vbmi2",
+         bench_shift<vqf_interleaved_block, vqf::update_tags_512_expand, vqf::remove_tags_512_expand>());
+#endif
+   report("split-scalar",
+         bench_shift<vqf_split_block, vqf::update_tags_split_scalar, vqf::remove_tags_split_scalar>());
+#ifdef __AVX512VBMI__
+   report("split-vbmi",
+         bench_shift<vqf_split_block, vqf::update_tags_split_512, vqf::remove_tags_split_512>());
+#endif
+
+   printf("Select (lookup_64):\n");
+   report("pdep", bench_lookup<uint64_t, vqf::lookup_64_pdep>());
+   report("broadword", bench_lookup<uint64_t, vqf::lookup_64_broadword>());
+   printf("Metadata shift (update_md + remove_md):\n");
+   report("pdep/pext", bench_md_shift<vqf::update_md_pdep, vqf::remove_md_pdep>());
+   report("broadword", bench_md_shift<vqf::update_md_broadword, vqf::remove_md_broadword>());
+
+   printf("Tag match mask, %d slots:\n", QUQU_SLOTS_PER_BLOCK);
+   report("loop", bench_match<vqf::tag_match_mask_loop>());
+   report("swar", bench_match<vqf::tag_match_mask_swar>());
+#ifdef __AVX512BW__
+   report("avx512", bench_match<vqf::tag_match_mask_512>());
+#endif
+   report("split-swar", bench_split_match<vqf::tag_match_mask_split_swar>());
+#ifdef __AVX2__
+   report("split-avx2", bench_split_match<vqf::tag_match_mask_split_256>());
+#endif
+
+   return 0;
+}
@@ -18,17 +18,16 @@
 #include <tmmintrin.h>
 #include <openssl/rand.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <set>
 
 #include "vqf_filter.h"
-
-#ifdef __AVX512BW__
-extern __m512i SHUFFLE [];
-extern __m512i SHUFFLE_REMOVE [];
-extern __m512i SHUFFLE16 [];
-extern __m512i SHUFFLE_REMOVE16 [];
-#endif
+#include "vqf_inline.h"
+#include "latency_histogram.h"
+#include "perf_counters.h"
+#include "bench_report.h"
 
 uint64_t tv2usec(struct timeval *tv) {
    return 1000000 * tv->tv_sec + tv->tv_usec;
@@ -46,6 +45,159 @@ void print_time_elapsed(const char* desc, struct timeval* start, struct
    printf("\n");
 }
 
+/* Millions of operations per second between the start and end timeval */
+double mops(struct timeval* start, struct timeval* end, uint64_t ops)
+{
+   return 1.0 * ops / (tv2usec(end) - tv2usec(start));
+}
+
+/* Median and spread of each phase over the repeated runs */
+void print_summary(bench_report *report)
+{
+   printf("%-26s %10s %10s %10s\n", "phase (Mops/s)", "median", "stddev", "runs");
+   for (size_t i = 0; i < report->results.size(); i++) {
+      bench_result *res = &report->results[i];
+      bench_result_stats(res);
+      printf("%-26s %10.3f %10.3f %10lu\n", res->phase.c_str(), res->median, res->stddev,
+            res->runs);
+   }
+}
+
+/* Each size in the sweep runs its phases at least this many times in all */
+#define SWEEP_MIN_OPS (1ULL << 24)
+
+/* Sizes whose filter and keys need more than this share of memory are skipped */
+#define SWEEP_MEMORY_SHARE 0.5
+
+enum { SWEEP_INSERT, SWEEP_POSITIVE, SWEEP_NEGATIVE, SWEEP_REMOVE, SWEEP_PHASES };
+
+uint64_t now_nsec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+/* Fill keys with n random hashes below range; RAND_bytes takes an int length */
+void random_keys(uint64_t *keys, uint64_t n, uint64_t range)
+{
+   const uint64_t chunk = 1ULL << 24;
+   for (uint64_t i = 0; i < n; i += chunk) {
+      uint64_t len = n - i < chunk ? n - i : chunk;
+      RAND_bytes((unsigned char *)(keys + i), sizeof(*keys) * len);
+   }
+   for (uint64_t i = 0; i < n; i++)
+      keys[i] %= range;
+}
+
+/*
+ * Throughput of insert, positive and negative lookup and remove at 85% load
+ * for filters of 2^min_qbits to 2^max_qbits slots, to show where the filter
+ * falls out of each cache level. Small filters repeat the insert, lookup and
+ * remove cycle until SWEEP_MIN_OPS operations have run, so that every size is
+ * timed over a similar interval.
+ */
+void sweep(uint64_t min_qbits, uint64_t max_qbits, bench_report *report)
+{
+   static const char *phase_names[SWEEP_PHASES] = {
+      "insert", "successful lookup", "random lookup", "remove"
+   };
+   uint64_t memory = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+   uint64_t nsizes = max_qbits - min_qbits + 1;
+   double *mops_by_size = (double *)calloc(nsizes * SWEEP_PHASES, sizeof(double));
+   uint64_t *failures = (uint64_t *)calloc(nsizes, sizeof(uint64_t));
+   uint64_t *nfps = (uint64_t *)calloc(nsizes, sizeof(uint64_t));
+   bool *skipped = (bool *)calloc(nsizes, sizeof(bool));
+
+   for (uint64_t qbits = min_qbits; qbits <= max_qbits; qbits++) {
+      uint64_t k = qbits - min_qbits;
+      uint64_t nslots = 1ULL << qbits;
+      uint64_t nvals = 85*nslots/100;
+      uint64_t nblocks = (nslots + QUQU_SLOTS_PER_BLOCK)/QUQU_SLOTS_PER_BLOCK;
+      uint64_t footprint = nblocks * sizeof(vqf_block) + 2 * nvals * sizeof(uint64_t);
+      if (footprint > SWEEP_MEMORY_SHARE * memory) {
+         skipped[k] = true;
+         continue;
+      }
+
+      vqf_filter *filter = vqf_init(nslots);
+      if (filter == NULL) {
+         skipped[k] = true;
+         continue;
+      }
+      uint64_t *vals = (uint64_t*)malloc(nvals*sizeof(vals[0]));
+      uint64_t *other_vals = (uint64_t*)malloc(nvals*sizeof(other_vals[0]));
+      if (vals == NULL || other_vals == NULL) {
+         free(vals);
+         free(other_vals);
+         free(filter);
+         skipped[k] = true;
+         continue;
+      }
+      random_keys(vals, nvals, filter->metadata.range);
+      random_keys(other_vals, nvals, filter->metadata.range);
+
+      uint64_t reps = nvals < SWEEP_MIN_OPS ? SWEEP_MIN_OPS / nvals : 1;
+      uint64_t elapsed[SWEEP_PHASES] = {0}, start;
+      for (uint64_t rep = 0; rep < reps; rep++) {
+         start = now_nsec();
+         for (uint64_t i = 0; i < nvals; i++)
+            failures[k] += !vqf_insert(filter, vals[i]);
+         elapsed[SWEEP_INSERT] += now_nsec() - start;
+
+         start = now_nsec();
+         for (uint64_t i = 0; i < nvals; i++)
+            if (!vqf_is_present(filter, vals[i]))
+               abort();
+         elapsed[SWEEP_POSITIVE] += now_nsec() - start;
+
+         start = now_nsec();
+         for (uint64_t i = 0; i < nvals; i++)
+            nfps[k] += vqf_is_present(filter, other_vals[i]);
+         elapsed[SWEEP_NEGATIVE] += now_nsec() - start;
+
+         /* Emptying the filter lets the next repetition start afresh */
+         start = now_nsec();
+         for (uint64_t i = 0; i < nvals; i++)
+            vqf_remove(filter, vals[i]);
+         elapsed[SWEEP_REMOVE] += now_nsec() - start;
+      }
+      for (int phase = 0; phase < SWEEP_PHASES; phase++) {
+         double mops = 1000.0 * reps * nvals / elapsed[phase];
+         mops_by_size[k * SWEEP_PHASES + phase] = mops;
+         bench_report_add(report, phase_names[phase], qbits, "Mops/s", mops);
+      }
+      failures[k] /= reps;
+      nfps[k] /= reps;
+
+      free(filter);
+      free(vals);
+      free(other_vals);
+   }
+
+   printf("%6s %14s %12s %10s %10s %10s %10s %10s %10s\n", "qbits", "slots", "MiB",
+         "insert", "lookup+", "lookup-", "remove", "failures", "FP rate");
+   for (uint64_t qbits = min_qbits; qbits <= max_qbits; qbits++) {
+      uint64_t k = qbits - min_qbits;
+      uint64_t nslots = 1ULL << qbits;
+      uint64_t nblocks = (nslots + QUQU_SLOTS_PER_BLOCK)/QUQU_SLOTS_PER_BLOCK;
+      printf("%6lu %14lu %12.3f", qbits, nslots, 1.0 * nblocks * sizeof(vqf_block) / (1 << 20));
+      if (skipped[k]) {
+         printf("    skipped: needs more than %.0f%% of memory\n", 100 * SWEEP_MEMORY_SHARE);
+         continue;
+      }
+      for (int phase = 0; phase < SWEEP_PHASES; phase++)
+         printf(" %10.2f", mops_by_size[k * SWEEP_PHASES + phase]);
+      printf(" %10lu %10.6f\n", failures[k], 1.0 * nfps[k] / (85*nslots/100));
+   }
+   printf("Throughput in million operations per second at load factor 0.85\n");
+
+   free(mops_by_size);
+   free(failures);
+   free(nfps);
+   free(skipped);
+}
+
 int main(int argc, char **argv)
 {
 
@@ -62,84 +214,264 @@ int main(int argc, char **argv)
 
    if (argc < 2) {
       fprintf(stderr, "Please specify the log of the number of slots in the CQF.\n");
+      fprintf(stderr, "Usage: %s qbits [runs] [results.json|results.csv]\n", argv[0]);
+      fprintf(stderr, "       %s sweep [min_qbits] [max_qbits] [results.json|results.csv]\n",
+            argv[0]);
       exit(1);
    }
+
+   if (strcmp(argv[1], "sweep") == 0) {
+      uint64_t min_qbits = argc > 2 ? strtoull(argv[2], NULL, 10) : 10;
+      uint64_t max_qbits = argc > 3 ? strtoull(argv[3], NULL, 10) : 32;
+      const char *results_file = argc > 4 ? argv[4] : NULL;
+      if (min_qbits < 6 || max_qbits > 40 || min_qbits > max_qbits) {
+         fprintf(stderr, "Sweep sizes must satisfy 6 <= min_qbits <= max_qbits <= 40.\n");
+         exit(1);
+      }
+
+      bench_report report;
+      bench_report_config(&report, "program", "main sweep");
+      bench_report_config(&report, "point", "qbits");
+      bench_report_config(&report, "load_factor", 0.85);
+      bench_report_config(&report, "tag_shift", VQF_TAG_SHIFT_KERNEL);
+      bench_report_config(&report, "tag_match", VQF_MATCH_KERNEL);
+      bench_report_config(&report, "threads", 1);
+      bench_report_config(&report, "distribution", "uniform");
+      sweep(min_qbits, max_qbits, &report);
+      if (results_file && !bench_report_write(&report, results_file))
+         exit(EXIT_FAILURE);
+      return 0;
+   }
    uint64_t qbits = atoi(argv[1]);
+   uint64_t nruns = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+   const char *results_file = argc > 3 ? argv[3] : NULL;
+   if (nruns == 0)
+      nruns = 1;
    uint64_t nslots = (1ULL << qbits);
    uint64_t nvals = 85*nslots/100;
    uint64_t *vals;
    uint64_t *other_vals;
 
-   vqf_filter *filter;	
-
-   /* initialize vqf filter */
-   if ((filter = vqf_init(nslots)) == NULL) {
-      fprintf(stderr, "Can't allocate vqf filter.");
-      exit(EXIT_FAILURE);
-   }
-
-   /* Generate random values */
-   vals = (uint64_t*)malloc(nvals*sizeof(vals[0]));
-   other_vals = (uint64_t*)malloc(nvals*sizeof(other_vals[0]));
-   RAND_bytes((unsigned char *)vals, sizeof(*vals) * nvals);
-   for (uint64_t i = 0; i < nvals; i++) {
-      vals[i] = (1 * vals[i]) % filter->metadata.range;
-   }
-   RAND_bytes((unsigned char *)other_vals, sizeof(*other_vals) * nvals);
-   for (uint64_t i = 0; i < nvals; i++) {
-      other_vals[i] = (1 * other_vals[i]) % filter->metadata.range;
-   }
+   vqf_filter *filter;
 
    struct timeval start, end;
    struct timezone tzp;
 
-   gettimeofday(&start, &tzp);
-   /* Insert hashes in the vqf filter */
-   for (uint64_t i = 0; i < nvals; i++) {
-      if (!vqf_insert(filter, vals[i])) {
-         fprintf(stderr, "Insertion failed");
+   /* Hardware counters of one phase, if perf events are permitted */
+   perf_counters pc;
+   perf_counters_open(&pc);
+
+   /* Latencies of one phase, timing one operation in LATENCY_SAMPLE_PERIOD */
+   static latency_histogram lat;
+   const uint64_t sample_mask = LATENCY_SAMPLE_PERIOD - 1;
+   bool ret;
+
+   /* Throughput of every phase in every run, written to results_file */
+   bench_report report;
+   bench_report_config(&report, "program", "main");
+   bench_report_config(&report, "nslots", nslots);
+   bench_report_config(&report, "load_factor", 0.85);
+   bench_report_config(&report, "tag_shift", VQF_TAG_SHIFT_KERNEL);
+   bench_report_config(&report, "tag_match", VQF_MATCH_KERNEL);
+   bench_report_config(&report, "threads", 1);
+   bench_report_config(&report, "distribution", "uniform");
+
+   for (uint64_t run = 0; run < nruns; run++) {
+      if (nruns > 1)
+         printf("Run %lu\n", run);
+
+      /* initialize vqf filter */
+      if ((filter = vqf_init(nslots)) == NULL) {
+         fprintf(stderr, "Can't allocate vqf filter.");
          exit(EXIT_FAILURE);
-      } else {
-         if (!vqf_is_present(filter, vals[i])){
-            printf("Failure to insert %llx\n", vals[i]);
+      }
+
+      /* Generate random values */
+      vals = (uint64_t*)malloc(nvals*sizeof(vals[0]));
+      other_vals = (uint64_t*)malloc(nvals*sizeof(other_vals[0]));
+      RAND_bytes((unsigned char *)vals, sizeof(*vals) * nvals);
+      for (uint64_t i = 0; i < nvals; i++) {
+         vals[i] = (1 * vals[i]) % filter->metadata.range;
+      }
+      RAND_bytes((unsigned char *)other_vals, sizeof(*other_vals) * nvals);
+      for (uint64_t i = 0; i < nvals; i++) {
+         other_vals[i] = (1 * other_vals[i]) % filter->metadata.range;
+      }
+
+      latency_reset(&lat);
+      perf_counters_start(&pc);
+      gettimeofday(&start, &tzp);
+      /* Insert hashes in the vqf filter */
+      for (uint64_t i = 0; i < nvals; i++) {
+         if (latency_sampled(i, sample_mask)) {
+            uint64_t op_start = latency_now();
+            ret = vqf_insert(filter, vals[i]);
+            latency_record(&lat, latency_now() - op_start);
+         } else {
+            ret = vqf_insert(filter, vals[i]);
+         }
+         if (!ret) {
+            fprintf(stderr, "Insertion failed");
+            exit(EXIT_FAILURE);
+         } else {
+            if (!vqf_is_present(filter, vals[i])){
+               printf("Failure to insert %llx\n", vals[i]);
+               vqf_is_present(filter, vals[i]);
+            }
+         }
+      }
+      gettimeofday(&end, &tzp);
+      perf_counters_stop(&pc);
+      print_time_elapsed("Insertion time", &start, &end, nvals, "insert");
+      bench_report_add(&report, "insert", 85, "Mops/s", mops(&start, &end, nvals));
+      perf_counters_print(stdout, &pc, "Insert", nvals);
+      latency_print_header(stdout, "latency (ns)");
+      latency_print(stdout, "insert", &lat);
+
+      vqf_stats stats;
+      vqf_get_stats(filter, &stats);
+      vqf_print_stats(stdout, &stats);
+      if (run == 0) {
+         bench_report_config(&report, "allocated_bytes", stats.allocated_bytes);
+         bench_report_config(&report, "bits_per_entry", stats.bits_per_entry);
+      }
+
+      latency_reset(&lat);
+      perf_counters_start(&pc);
+      gettimeofday(&start, &tzp);
+      for (uint64_t i = 0; i < nvals; i++) {
+         if (latency_sampled(i, sample_mask)) {
+            uint64_t op_start = latency_now();
+            ret = vqf_is_present(filter, vals[i]);
+            latency_record(&lat, latency_now() - op_start);
+         } else {
+            ret = vqf_is_present(filter, vals[i]);
+         }
+         if (!ret) {
+            fprintf(stderr, "Lookup failed for %llu - %ld", i, vals[i]);
             vqf_is_present(filter, vals[i]);
+            exit(EXIT_FAILURE);
          }
       }
-   }
-   gettimeofday(&end, &tzp);
-   print_time_elapsed("Insertion time", &start, &end, nvals, "insert");
-
-   gettimeofday(&start, &tzp);
-   for (uint64_t i = 0; i < nvals; i++) {
-      if (!vqf_is_present(filter, vals[i])) {
-         fprintf(stderr, "Lookup failed for %llu - %ld", i, vals[i]);
-         vqf_is_present(filter, vals[i]);
+      gettimeofday(&end, &tzp);
+      perf_counters_stop(&pc);
+      print_time_elapsed("Lookup time", &start, &end, nvals, "successful lookup");
+      bench_report_add(&report, "successful lookup", 85, "Mops/s", mops(&start, &end, nvals));
+      perf_counters_print(stdout, &pc, "Successful lookup", nvals);
+      latency_print(stdout, "successful lookup", &lat);
+
+      latency_reset(&lat);
+      perf_counters_start(&pc);
+      gettimeofday(&start, &tzp);
+      uint64_t nfps = 0;
+      /* Lookup hashes in the vqf filter */
+      for (uint64_t i = 0; i < nvals; i++) {
+         if (latency_sampled(i, sample_mask)) {
+            uint64_t op_start = latency_now();
+            ret = vqf_is_present(filter, other_vals[i]);
+            latency_record(&lat, latency_now() - op_start);
+         } else {
+            ret = vqf_is_present(filter, other_vals[i]);
+         }
+         if (ret) {
+            nfps++;
+         }
+      }
+      gettimeofday(&end, &tzp);
+      perf_counters_stop(&pc);
+      print_time_elapsed("Random lookup:", &start, &end, nvals, "random lookup");
+      bench_report_add(&report, "random lookup", 85, "Mops/s", mops(&start, &end, nvals));
+      perf_counters_print(stdout, &pc, "Random lookup", nvals);
+      latency_print(stdout, "random lookup", &lat);
+      printf("%lu/%lu positives\n"
+            "FP rate: 1/%f\n",
+            nfps, nvals,
+            1.0 * nvals / nfps);
+
+      /* Same operations through the header-only API, to measure call overhead */
+      vqf_filter *inline_filter;
+      if ((inline_filter = vqf_init(nslots)) == NULL) {
+         fprintf(stderr, "Can't allocate vqf filter.");
          exit(EXIT_FAILURE);
       }
-   }
-   gettimeofday(&end, &tzp);
-   print_time_elapsed("Lookup time", &start, &end, nvals, "successful lookup");
-   gettimeofday(&start, &tzp);
-   uint64_t nfps = 0;
-   /* Lookup hashes in the vqf filter */
-   for (uint64_t i = 0; i < nvals; i++) {
-      if (vqf_is_present(filter, other_vals[i])) {
-         nfps++;
+      vqf::view inline_view = vqf::make_view(inline_filter);
+
+      perf_counters_start(&pc);
+      gettimeofday(&start, &tzp);
+      for (uint64_t i = 0; i < nvals; i++) {
+         if (!vqf::insert(inline_view, vals[i])) {
+            fprintf(stderr, "Insertion failed");
+            exit(EXIT_FAILURE);
+         } else if (!vqf::is_present(inline_view, vals[i])) {
+            printf("Failure to insert %lx\n", vals[i]);
+         }
       }
+      gettimeofday(&end, &tzp);
+      perf_counters_stop(&pc);
+      print_time_elapsed("Inline insertion time", &start, &end, nvals, "insert");
+      bench_report_add(&report, "inline insert", 85, "Mops/s", mops(&start, &end, nvals));
+      perf_counters_print(stdout, &pc, "Inline insert", nvals);
+
+      perf_counters_start(&pc);
+      gettimeofday(&start, &tzp);
+      for (uint64_t i = 0; i < nvals; i++) {
+         if (!vqf::is_present(inline_view, vals[i])) {
+            fprintf(stderr, "Lookup failed for %lu - %ld", i, vals[i]);
+            exit(EXIT_FAILURE);
+         }
+      }
+      gettimeofday(&end, &tzp);
+      perf_counters_stop(&pc);
+      print_time_elapsed("Inline lookup time", &start, &end, nvals, "successful lookup");
+      bench_report_add(&report, "inline successful lookup", 85, "Mops/s", mops(&start, &end, nvals));
+      perf_counters_print(stdout, &pc, "Inline successful lookup", nvals);
+
+      perf_counters_start(&pc);
+      gettimeofday(&start, &tzp);
+      uint64_t inline_nfps = 0;
+      for (uint64_t i = 0; i < nvals; i++) {
+         inline_nfps += vqf::is_present(inline_view, other_vals[i]);
+      }
+      gettimeofday(&end, &tzp);
+      perf_counters_stop(&pc);
+      print_time_elapsed("Inline random lookup:", &start, &end, nvals, "random lookup");
+      bench_report_add(&report, "inline random lookup", 85, "Mops/s", mops(&start, &end, nvals));
+      perf_counters_print(stdout, &pc, "Inline random lookup", nvals);
+      printf("%lu/%lu positives\n", inline_nfps, nvals);
+      free(inline_filter);
+
+      latency_reset(&lat);
+      perf_counters_start(&pc);
+      gettimeofday(&start, &tzp);
+      for (uint64_t i = 0; i < nvals; i++) {
+         if (latency_sampled(i, sample_mask)) {
+            uint64_t op_start = latency_now();
+            vqf_remove(filter, vals[i]);
+            latency_record(&lat, latency_now() - op_start);
+         } else {
+            vqf_remove(filter, vals[i]);
+         }
+      }
+      gettimeofday(&end, &tzp);
+      perf_counters_stop(&pc);
+      print_time_elapsed("Remove time", &start, &end, nvals, "remove");
+      bench_report_add(&report, "remove", 85, "Mops/s", mops(&start, &end, nvals));
+      perf_counters_print(stdout, &pc, "Remove", nvals);
+      latency_print(stdout, "remove", &lat);
+
+      free(filter);
+      free(vals);
+      free(other_vals);
    }
-   gettimeofday(&end, &tzp);
-   print_time_elapsed("Random lookup:", &start, &end, nvals, "random lookup");
-   printf("%lu/%lu positives\n"
-         "FP rate: 1/%f\n",
-         nfps, nvals,
-         1.0 * nvals / nfps);
-
-   gettimeofday(&start, &tzp);
-   for (uint64_t i = 0; i < nvals; i++) {
-      vqf_remove(filter, vals[i]);
-   }
-   gettimeofday(&end, &tzp);
-   print_time_elapsed("Remove time", &start, &end, nvals, "remove");
+   perf_counters_close(&pc);
+   vqf_events events;
+   if (vqf_get_events(&events))
+      vqf_print_events(stdout, &events);
+
+   if (nruns > 1)
+      print_summary(&report);
+   if (results_file && !bench_report_write(&report, results_file))
+      exit(EXIT_FAILURE);
 
    return 0;
 }
@@ -2,7 +2,7 @@
  * ============================================================================
  *
  *        Authors:  Prashant Pandey <ppandey@cs.stonybrook.edu>
- *                  Rob Johnson <robj@vmware.com>   
+ *                  Rob Johnson <robj@vmware.com>
  *
  * ============================================================================
  */
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <sched.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -18,132 +19,268 @@
 #include <openssl/rand.h>
 
 #include "vqf_filter.h"
+#include "vqf_inline.h"
+#include "perf_counters.h"
+#include "bench_report.h"
 
 uint64_t tv2usec(struct timeval *tv) {
    return 1000000 * tv->tv_sec + tv->tv_usec;
 }
 
-/* Print elapsed time using the start and end timeval */
-void print_time_elapsed(const char* desc, struct timeval* start, struct
-      timeval* end, uint64_t ops, const char *opname)
-{
-   uint64_t elapsed_usecs = tv2usec(end) - tv2usec(start);
-   printf("%s Total Time Elapsed: %f seconds", desc, 1.0*elapsed_usecs / 1000000);
-   if (ops) {
-      printf(" (%f nanoseconds/%s)", 1000.0 * elapsed_usecs / ops, opname);
-   }
-   printf("\n");
-}
-
-
 typedef struct args {
    vqf_filter *cf;
    uint64_t *vals;
    uint64_t start;
    uint64_t end;
+   uint32_t queries_per_insert;
+   int cpu;
+   pthread_barrier_t *barrier;
+
+   /* Filled in by the thread */
+   uint64_t nops;
+   uint64_t failures;
+   uint64_t missed;
+   uint64_t elapsed_usecs;
+   vqf::lock_stats locks;
 } args;
 
-void *insert_bm(void *arg)
-{
-   args *a = (args *)arg;
-   for (uint32_t i = a->start; i <= a->end; i++) {
-      int ret = vqf_insert(a->cf, a->vals[i]);
-      if (ret < 0) {
-         fprintf(stderr, "failed insertion for key: %lx.\n", a->vals[i]);
-         abort();
-      }
-   }
-   return NULL;
-}
+/* The totals of one thread count */
+typedef struct scaling_point {
+   uint64_t nops;
+   uint64_t elapsed_usecs;
+   vqf::lock_stats locks;
+} scaling_point;
 
-void *query_bm(void *arg)
+/*
+ * Inserts vals[start..end] and, after each insert, looks up queries_per_insert
+ * keys this thread has already inserted. Lookups take no locks, so the lock
+ * counters measure contention between inserts.
+ */
+void *mixed_bm(void *arg)
 {
    args *a = (args *)arg;
-   for (uint32_t i = a->start; i <= a->end; i++) {
-      int ret = vqf_is_present(a->cf, a->vals[i]);
-      if (ret < 0) {
-         fprintf(stderr, "failed insertion for key: %lx.\n", a->vals[i]);
-         abort();
+   uint64_t x = 0x9e3779b97f4a7c15ULL ^ a->start;
+   struct timeval start, end;
+
+   a->failures = a->missed = 0;
+   pthread_barrier_wait(a->barrier);
+   vqf::thread_lock_stats() = vqf::lock_stats();
+   gettimeofday(&start, NULL);
+   for (uint64_t i = a->start; i <= a->end; i++) {
+      a->failures += !vqf_insert(a->cf, a->vals[i]);
+      for (uint32_t q = 0; q < a->queries_per_insert; q++) {
+         x ^= x << 13;
+         x ^= x >> 7;
+         x ^= x << 17;
+         uint64_t pick = a->start + (uint64_t)(((__uint128_t)x * (i - a->start + 1)) >> 64);
+         a->missed += !vqf_is_present(a->cf, a->vals[pick]);
       }
    }
+   gettimeofday(&end, NULL);
+   a->nops = (a->end - a->start + 1) * (1 + a->queries_per_insert);
+   a->elapsed_usecs = tv2usec(&end) - tv2usec(&start);
+   a->locks = vqf::thread_lock_stats();
    return NULL;
 }
 
-void multi_threaded_insertion(args args[], int tcnt)
+/* Runs the threads, each pinned to a CPU, and times them from a common start */
+uint64_t multi_threaded_run(args args[], int tcnt)
 {
    pthread_t threads[tcnt];
+   pthread_barrier_t barrier;
+   struct timeval start, end;
 
+   pthread_barrier_init(&barrier, NULL, tcnt + 1);
    for (int i = 0; i < tcnt; i++) {
-      fprintf(stdout, "Thread %d bounds %ld %ld\n", i, args[i].start, args[i].end);
-      if (pthread_create(&threads[i], NULL, &insert_bm, &args[i])) {
+      pthread_attr_t attr;
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(args[i].cpu, &cpus);
+      pthread_attr_init(&attr);
+      pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+      args[i].barrier = &barrier;
+      if (pthread_create(&threads[i], &attr, &mixed_bm, &args[i])) {
          fprintf(stderr, "Error creating thread\n");
          exit(0);
       }
+      pthread_attr_destroy(&attr);
    }
 
+   pthread_barrier_wait(&barrier);
+   gettimeofday(&start, NULL);
    for (int i = 0; i < tcnt; i++) {
       if (pthread_join(threads[i], NULL)) {
          fprintf(stderr, "Error joining thread\n");
          exit(0);
       }
    }
+   gettimeofday(&end, NULL);
+   pthread_barrier_destroy(&barrier);
+   return tv2usec(&end) - tv2usec(&start);
+}
+
+void print_lock_row(const char *name, int cpu, uint64_t nops, uint64_t usecs,
+      const vqf::lock_stats *locks)
+{
+   char cpu_name[16] = "-";
+   if (cpu >= 0)
+      snprintf(cpu_name, sizeof(cpu_name), "%d", cpu);
+   printf("%-8s %4s %12lu %10.2f %12lu %10lu %14lu %10.3f\n", name, cpu_name, nops,
+         usecs ? 1.0 * nops / usecs : 0, locks->contended, locks->retries, locks->spins,
+         nops ? 1.0 * locks->spins / nops : 0);
 }
 
 int main(int argc, char **argv)
 {
    if (argc < 3) {
-      fprintf(stderr, "Please specify three arguments: \n \
+      fprintf(stderr, "Please specify at least two arguments: \n \
             1. log of the number of slots in the CQF.\n \
-            2. number of threads.\n");
+            2. largest number of threads; every count from 1 is run.\n \
+            3. lookups after each insert (optional, default 1).\n \
+            4. results file, .json or .csv (optional).\n");
       exit(1);
    }
    uint64_t qbits = atoi(argv[1]);
-   uint32_t tcnt = atoi(argv[2]);
-   uint64_t nhashbits = qbits + 8;
+   uint32_t max_threads = atoi(argv[2]);
+   uint32_t queries_per_insert = argc > 3 ? atoi(argv[3]) : 1;
+   const char *results_file = argc > 4 ? argv[4] : NULL;
    uint64_t nslots = (1ULL << qbits);
    uint64_t nvals = 85*nslots/100;
 
+   if (max_threads == 0) {
+      fprintf(stderr, "The number of threads must be positive.\n");
+      exit(1);
+   }
+   if (max_threads > 1 && !VQF_THREAD_SAFE) {
+      fprintf(stderr, "Build with THREAD=1 to run more than one thread.\n");
+      exit(1);
+   }
+
    uint64_t *vals;
-   vqf_filter *filter;	
+   vqf_filter *filter;
 
-   /* initialize vqf filter */
-   if ((filter = vqf_init(nslots)) == NULL) {
-      fprintf(stderr, "Can't allocate vqf filter.");
-      exit(EXIT_FAILURE);
-   }
+   /* Threads are pinned round-robin to the CPUs this process may use */
+   cpu_set_t allowed;
+   int cpus[CPU_SETSIZE], ncpus = 0;
+   sched_getaffinity(0, sizeof(allowed), &allowed);
+   for (int c = 0; c < CPU_SETSIZE; c++)
+      if (CPU_ISSET(c, &allowed))
+         cpus[ncpus++] = c;
+   if (max_threads > (uint32_t)ncpus)
+      printf("Note: %u threads on %d CPUs; the extra threads share CPUs.\n", max_threads,
+            ncpus);
 
    /* Generate random values */
    vals = (uint64_t*)calloc(nvals, sizeof(vals[0]));
    RAND_bytes((unsigned char *)vals, sizeof(*vals) * nvals);
-   for (uint32_t i = 0; i < nvals; i++) {
-      vals[i] = (1 * vals[i]) % filter->metadata.range;
-   }
 
-   args *arg = (args*)malloc(tcnt * sizeof(args));
-   for (uint32_t i = 0; i < tcnt; i++) {
-      arg[i].cf = filter;
-      arg[i].vals = vals;
-      arg[i].start = (nvals/tcnt) * i;
-      arg[i].end = (nvals/tcnt) * (i + 1) - 1;
-   }
-   //fprintf(stdout, "Total number of items: %ld\n", arg[tcnt-1].end);
+   /* Opened before the threads start, so their events are counted too */
+   perf_counters pc;
+   perf_counters_open(&pc);
 
-   struct timeval start, end;
-   struct timezone tzp;
+   bench_report report;
+   bench_report_config(&report, "program", "main_tx");
+   bench_report_config(&report, "point", "threads");
+   bench_report_config(&report, "nslots", nslots);
+   bench_report_config(&report, "load_factor", 0.85);
+   bench_report_config(&report, "tag_shift", VQF_TAG_SHIFT_KERNEL);
+   bench_report_config(&report, "tag_match", VQF_MATCH_KERNEL);
+   bench_report_config(&report, "threads", max_threads);
+   bench_report_config(&report, "distribution", "uniform");
+   bench_report_config(&report, "queries_per_insert", queries_per_insert);
 
-   gettimeofday(&start, &tzp);
-   multi_threaded_insertion(arg, tcnt);
-   gettimeofday(&end, &tzp);
-   print_time_elapsed("Insertion time", &start, &end, nvals, "insert");
+   scaling_point *points = (scaling_point *)calloc(max_threads + 1, sizeof(scaling_point));
+   args *arg = (args*)malloc(max_threads * sizeof(args));
+   for (uint32_t tcnt = 1; tcnt <= max_threads; tcnt++) {
+      /* initialize vqf filter */
+      if ((filter = vqf_init(nslots)) == NULL) {
+         fprintf(stderr, "Can't allocate vqf filter.");
+         exit(EXIT_FAILURE);
+      }
+      if (tcnt == 1) {
+         for (uint64_t i = 0; i < nvals; i++)
+            vals[i] = (1 * vals[i]) % filter->metadata.range;
+      }
 
-   //fprintf(stdout, "Inserted all items: %ld\n", arg[tcnt-1].end);
+      for (uint32_t i = 0; i < tcnt; i++) {
+         arg[i].cf = filter;
+         arg[i].vals = vals;
+         arg[i].start = nvals * i / tcnt;
+         arg[i].end = nvals * (i + 1) / tcnt - 1;
+         arg[i].queries_per_insert = queries_per_insert;
+         arg[i].cpu = cpus[i % ncpus];
+      }
+
+      perf_counters_start(&pc);
+      uint64_t elapsed_usecs = multi_threaded_run(arg, tcnt);
+      perf_counters_stop(&pc);
+
+      scaling_point *p = &points[tcnt];
+      uint64_t failures = 0, missed = 0;
+      p->elapsed_usecs = elapsed_usecs;
+      printf("Threads: %u\n", tcnt);
+      printf("%-8s %4s %12s %10s %12s %10s %14s %10s\n", "thread", "cpu", "ops", "Mops/s",
+            "contended", "retries", "spins", "spins/op");
+      for (uint32_t i = 0; i < tcnt; i++) {
+         char name[16];
+         snprintf(name, sizeof(name), "%u", i);
+         print_lock_row(name, arg[i].cpu, arg[i].nops, arg[i].elapsed_usecs, &arg[i].locks);
+         p->nops += arg[i].nops;
+         p->locks.contended += arg[i].locks.contended;
+         p->locks.retries += arg[i].locks.retries;
+         p->locks.spins += arg[i].locks.spins;
+         failures += arg[i].failures;
+         missed += arg[i].missed;
+      }
+      print_lock_row("all", -1, p->nops, p->elapsed_usecs, &p->locks);
+      perf_counters_print(stdout, &pc, "Mixed", p->nops);
+      if (failures || missed)
+         printf("%lu failed inserts, %lu missed lookups\n", failures, missed);
+      bench_report_add(&report, "mixed", tcnt, "Mops/s", 1.0 * p->nops / p->elapsed_usecs);
+
+      vqf_stats stats;
+      vqf_get_stats(filter, &stats);
+      vqf_print_stats(stdout, &stats);
 
-   for (uint64_t i = 0; i < arg[tcnt-1].end; i++) {
-      if (!vqf_is_present(filter, vals[i])) {
-         fprintf(stderr, "Lookup failed for %ld", vals[i]);
+      /* Every key that went in must still be found */
+      for (uint64_t i = 0; i < nvals; i++) {
+         if (!vqf_is_present(filter, vals[i]) && failures == 0) {
+            fprintf(stderr, "Lookup failed for %ld", vals[i]);
+            exit(EXIT_FAILURE);
+         }
+      }
+      /* The sharded count must match a recount of the blocks */
+      uint64_t counted = vqf_count_entries(filter, 0);
+      if (vqf_size(filter) != counted) {
+         fprintf(stderr, "vqf_size %lu, but the blocks hold %lu entries\n", vqf_size(filter),
+               counted);
          exit(EXIT_FAILURE);
       }
+      free(filter);
+   }
+   perf_counters_close(&pc);
+
+   /* Contended is per insert, since lookups take no lock */
+   uint64_t ninserts = nvals;
+   printf("%-8s %10s %8s %10s %12s %10s %10s\n", "threads", "Mops/s", "speedup",
+         "efficiency", "contended%", "retries", "spins/op");
+   for (uint32_t tcnt = 1; tcnt <= max_threads; tcnt++) {
+      scaling_point *p = &points[tcnt];
+      double mops = 1.0 * p->nops / p->elapsed_usecs;
+      double speedup = mops / (1.0 * points[1].nops / points[1].elapsed_usecs);
+      printf("%-8u %10.2f %8.2f %10.2f %12.4f %10lu %10.3f\n", tcnt, mops, speedup,
+            speedup / tcnt, 100.0 * p->locks.contended / ninserts, p->locks.retries,
+            1.0 * p->locks.spins / p->nops);
    }
+   vqf_events events;
+   if (vqf_get_events(&events))
+      vqf_print_events(stdout, &events);
+
+   if (results_file && !bench_report_write(&report, results_file))
+      exit(EXIT_FAILURE);
+   free(points);
+   free(arg);
+   free(vals);
 
    return 0;
 }
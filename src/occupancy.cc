@@ -0,0 +1,208 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  occupancy.cc
+ *
+ *    Description:  Fills a filter in steps and reports how evenly the blocks
+ *                  fill: at each step the spread of free slots per block, the
+ *                  share of blocks near full, full and past the alternate-
+ *                  block threshold, and the longest bucket run. At the end it
+ *                  prints the free-slot and run-length histograms and a
+ *                  heatmap of the load across the blocks.
+ *
+ *                  The keys are uniform, zipfian, or sequential integers
+ *                  used as hashes unchanged, which shows what an unhashed
+ *                  input does to the filter. With -T the inserts and removes
+ *                  of a trace (see vqf_trace.h) are applied instead, in time
+ *                  order.
+ *
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "vqf_filter.h"
+#include "vqf_inline.h"
+#include "vqf_trace.h"
+#include "zipf.h"
+
+enum key_distribution { KEYS_UNIFORM, KEYS_ZIPFIAN, KEYS_SEQUENTIAL };
+
+typedef struct fill_op {
+   uint64_t hash;
+   bool insert;
+} fill_op;
+
+static void gen_keys(std::vector<fill_op>& ops, uint64_t nkeys, uint64_t range, int dist,
+      double exponent, uint64_t seed) {
+   zipf_sampler zipf;
+   struct drand48_data rand;
+   if (dist == KEYS_ZIPFIAN) {
+      zipf_sampler_init(&zipf, nkeys, exponent);
+      srand48_r(seed, &rand);
+   }
+   ops.resize(nkeys);
+   for (uint64_t i = 0; i < nkeys; i++) {
+      uint64_t key = dist == KEYS_SEQUENTIAL ? i :
+         dist == KEYS_ZIPFIAN ? mix64(zipf_sample(&zipf, &rand) ^ seed) : mix64(i ^ seed);
+      ops[i].hash = key % range;
+      ops[i].insert = true;
+   }
+}
+
+static bool read_trace_ops(const char *path, std::vector<fill_op>& ops, uint64_t range,
+      uint64_t remainder_bits) {
+   vqf_trace_header header;
+   std::vector<vqf_trace_entry> entries;
+   if (!vqf_trace_read(path, &header, entries))
+      return false;
+   std::stable_sort(entries.begin(), entries.end(),
+         [](const vqf_trace_entry& a, const vqf_trace_entry& b) {
+            return a.cycles < b.cycles;
+         });
+   for (uint64_t i = 0; i < entries.size(); i++) {
+      uint8_t op = entries[i].op & ~VQF_TRACE_RESULT;
+      if (op == VQF_TRACE_INSERT || op == VQF_TRACE_REMOVE)
+         ops.push_back({vqf_trace_rescale(entries[i].hash, header.range, range, remainder_bits),
+               op == VQF_TRACE_INSERT});
+   }
+   return true;
+}
+
+static void print_point(uint64_t done, uint64_t failures, const vqf_occupancy *o,
+      uint64_t nslots) {
+   double n = o->nblocks;
+   printf("%10lu %8.4f %8.2f %8.2f %10.4f %10.4f %10.4f %6lu %10lu\n", done,
+         1.0 * o->entries / nslots, o->mean_free, o->stddev_free,
+         100 * o->alt_blocks / n, 100 * o->near_full_blocks / n, 100 * o->full_blocks / n,
+         o->longest_run, failures);
+}
+
+static void usage(const char *name) {
+   printf("%s [OPTIONS]\n"
+         "Options are:\n"
+         "  -n qbits       [ log_2 of filter capacity.  Default 20 ]\n"
+         "  -l load        [ load factor to fill to.  Default 0.95 ]\n"
+         "  -p npoints     [ report the occupancy at npoints steps.  Default 10 ]\n"
+         "  -d dist        [ keys: uniform, zipfian or sequential.  Default uniform ]\n"
+         "  -s exponent    [ zipfian exponent.  Default 0.99 ]\n"
+         "  -T tracefile   [ apply the inserts and removes of a trace instead ]\n"
+         "  -c cells       [ heatmap cells.  Default 256 ]\n"
+         "  -w width       [ heatmap cells per row.  Default 64 ]\n"
+         "  -t nthreads    [ threads scanning the blocks.  Default one per CPU ]\n",
+         name);
+}
+
+int main(int argc, char **argv)
+{
+   uint64_t qbits = 20, npoints = 10;
+   uint32_t ncells = 256, width = 64, nthreads = 0;
+   double load = 0.95, exponent = 0.99;
+   int dist = KEYS_UNIFORM;
+   const char *trace = NULL;
+   int opt;
+   char *term = NULL;
+
+   while ((opt = getopt(argc, argv, "n:l:p:d:s:T:c:w:t:")) != -1) {
+      switch (opt) {
+         case 'n':
+            qbits = strtoull(optarg, &term, 10);
+            break;
+         case 'l':
+            load = strtod(optarg, &term);
+            break;
+         case 'p':
+            npoints = strtoull(optarg, &term, 10);
+            break;
+         case 'd':
+            if (strcmp(optarg, "uniform") == 0)
+               dist = KEYS_UNIFORM;
+            else if (strcmp(optarg, "zipfian") == 0)
+               dist = KEYS_ZIPFIAN;
+            else if (strcmp(optarg, "sequential") == 0)
+               dist = KEYS_SEQUENTIAL;
+            else
+               term = optarg;
+            break;
+         case 's':
+            exponent = strtod(optarg, &term);
+            break;
+         case 'T':
+            trace = optarg;
+            break;
+         case 'c':
+            ncells = strtoul(optarg, &term, 10);
+            break;
+         case 'w':
+            width = strtoul(optarg, &term, 10);
+            break;
+         case 't':
+            nthreads = strtoul(optarg, &term, 10);
+            break;
+         default:
+            usage(argv[0]);
+            exit(1);
+      }
+      if (term != NULL && *term) {
+         fprintf(stderr, "Invalid argument to -%c: %s\n", opt, optarg);
+         usage(argv[0]);
+         exit(1);
+      }
+      term = NULL;
+   }
+   if (npoints == 0 || ncells == 0 || load <= 0 || load > 1 || exponent <= 0) {
+      usage(argv[0]);
+      exit(1);
+   }
+
+   vqf_filter *filter;
+   if ((filter = vqf_init(1ULL << qbits)) == NULL) {
+      fprintf(stderr, "Can't allocate vqf filter.");
+      exit(EXIT_FAILURE);
+   }
+   uint64_t nslots = filter->metadata.nslots;
+   std::vector<fill_op> ops;
+   if (trace) {
+      if (!read_trace_ops(trace, ops, filter->metadata.range,
+               filter->metadata.key_remainder_bits))
+         exit(EXIT_FAILURE);
+      printf("Applying %lu inserts and removes from %s\n", ops.size(), trace);
+   } else {
+      static const char *dist_names[] = {"uniform", "zipfian", "sequential"};
+      gen_keys(ops, load * nslots, filter->metadata.range, dist, exponent, 0x5eed);
+      printf("Inserting %lu %s keys\n", ops.size(), dist_names[dist]);
+   }
+
+   vqf_occupancy occupancy;
+   printf("%10s %8s %8s %8s %10s %10s %10s %6s %10s\n", "ops", "load", "free", "stddev",
+         "alt%", "near_full%", "full%", "run", "failures");
+   vqf::view v = vqf::make_view(filter);
+   uint64_t failures = 0, done = 0;
+   for (uint64_t point = 1; point <= npoints; point++) {
+      uint64_t end = ops.size() * point / npoints;
+      for (; done < end; done++) {
+         const fill_op& o = ops[done];
+         if (o.insert)
+            failures += !vqf::insert(v, o.hash);
+         else
+            vqf::remove(v, o.hash);
+      }
+      vqf_get_occupancy(filter, nthreads, &occupancy, NULL, 0);
+      print_point(done, failures, &occupancy, nslots);
+   }
+
+   std::vector<double> heatmap(ncells);
+   vqf_get_occupancy(filter, nthreads, &occupancy, heatmap.data(), ncells);
+   vqf_print_occupancy(stdout, &occupancy);
+   vqf_print_heatmap(stdout, heatmap.data(), ncells, width);
+
+   free(filter);
+   return 0;
+}
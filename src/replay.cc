@@ -0,0 +1,331 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  replay.cc
+ *
+ *    Description:  Applies a trace recorded with vqf_trace_start (see
+ *                  vqf_trace.h) to a fresh filter of any size and build, and
+ *                  reports throughput, latency percentiles for each operation
+ *                  type, and how many results differ from the traced ones.
+ *
+ *                  By default one thread applies every entry in time order
+ *                  as fast as it can. With -p each traced thread gets a
+ *                  replay thread of its own. With -T each entry is due at its
+ *                  recorded time, and its latency is measured from that time,
+ *                  as in the open-loop mode of workload.
+ *
+ *                  When the replay filter's range differs from the traced
+ *                  one, each hash's bucket is scaled to it and its tag kept,
+ *                  so the keys spread over the blocks as they did.
+ *
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "vqf_filter.h"
+#include "vqf_inline.h"
+#include "vqf_trace.h"
+#include "latency_histogram.h"
+#include "bench_report.h"
+
+static const char *op_names[VQF_TRACE_NUM_OPS] = {
+   "insert", "remove", "is_present", "query"
+};
+
+typedef struct replay_thread {
+   pthread_t thread;
+   vqf::view v;
+   pthread_barrier_t *start;
+   // TSC cycle the replay starts at, set before the barrier
+   const uint64_t *start_cycles;
+   // local TSC cycles per traced cycle under -T; 0 at full speed
+   double timing;
+   uint64_t sample_mask;
+
+   std::vector<vqf_trace_entry> entries;
+
+   uint64_t counts[VQF_TRACE_NUM_OPS];
+   uint64_t diverged[VQF_TRACE_NUM_OPS];
+   latency_histogram latencies[VQF_TRACE_NUM_OPS];
+} replay_thread;
+
+// Applies e and returns true if the result (and, for a query, the value)
+// matches the trace.
+static inline bool apply(const vqf::view& v, const vqf_trace_entry& e) {
+   bool traced = e.op & VQF_TRACE_RESULT;
+   uint8_t value = 0;
+   switch (e.op & ~VQF_TRACE_RESULT) {
+      case VQF_TRACE_INSERT:
+         return vqf::insert(v, e.hash, e.value) == traced;
+      case VQF_TRACE_REMOVE:
+         return vqf::remove(v, e.hash) == traced;
+      case VQF_TRACE_IS_PRESENT:
+         return vqf::is_present(v, e.hash) == traced;
+      default:
+         return vqf::query(v, e.hash, value) == traced && value == e.value;
+   }
+}
+
+static void *run_thread(void *arg) {
+   replay_thread *t = (replay_thread *)arg;
+
+   pthread_barrier_wait(t->start);
+   uint64_t start = *t->start_cycles, now = start;
+   for (uint64_t i = 0; i < t->entries.size(); i++) {
+      const vqf_trace_entry& e = t->entries[i];
+      uint8_t type = e.op & ~VQF_TRACE_RESULT;
+      bool sampled = latency_sampled(i, t->sample_mask);
+      uint64_t op_start = 0;
+      if (t->timing > 0) {
+         op_start = start + (uint64_t)(e.cycles * t->timing);
+         while (now < op_start) {
+            now = __rdtsc();
+            if (now < op_start)
+               _mm_pause();
+         }
+      } else if (sampled) {
+         op_start = latency_now();
+      }
+      t->diverged[type] += !apply(t->v, e);
+      t->counts[type]++;
+      if (sampled) {
+         now = latency_now();
+         latency_record(&t->latencies[type], now - op_start);
+      }
+   }
+   return NULL;
+}
+
+// Replays every thread's entries on a fresh filter of nslots. Leaves the
+// final state of the filter in stats and returns the nanoseconds from the
+// common start to the last thread finishing.
+static uint64_t replay(replay_thread *threads, uint32_t nthreads, uint64_t nslots,
+      vqf_stats *stats) {
+   vqf_filter *filter;
+   if ((filter = vqf_init(nslots)) == NULL) {
+      fprintf(stderr, "Can't allocate vqf filter.");
+      exit(EXIT_FAILURE);
+   }
+   pthread_barrier_t start;
+   uint64_t start_cycles;
+   pthread_barrier_init(&start, NULL, nthreads + 1);
+   for (uint32_t i = 0; i < nthreads; i++) {
+      threads[i].v = vqf::make_view(filter);
+      threads[i].start = &start;
+      threads[i].start_cycles = &start_cycles;
+      memset(threads[i].counts, 0, sizeof(threads[i].counts));
+      memset(threads[i].diverged, 0, sizeof(threads[i].diverged));
+      for (int type = 0; type < VQF_TRACE_NUM_OPS; type++)
+         latency_reset(&threads[i].latencies[type]);
+      if (pthread_create(&threads[i].thread, NULL, &run_thread, &threads[i])) {
+         fprintf(stderr, "Error creating thread\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   start_cycles = latency_now();
+   pthread_barrier_wait(&start);
+   for (uint32_t i = 0; i < nthreads; i++) {
+      if (pthread_join(threads[i].thread, NULL)) {
+         fprintf(stderr, "Error joining thread\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   uint64_t elapsed = latency_now() - start_cycles;
+   vqf_get_stats(filter, stats);
+   pthread_barrier_destroy(&start);
+   free(filter);
+   return elapsed * latency_nsec_per_cycle();
+}
+
+static void report(const replay_thread *threads, uint32_t nthreads, uint64_t nentries,
+      uint64_t elapsed_nsec, bool timed, const vqf_stats *stats) {
+   printf("Replayed %lu operations on %u thread%s in %.3f seconds: %.2f Mops/second\n",
+         nentries, nthreads, nthreads > 1 ? "s" : "", elapsed_nsec / 1e9,
+         1000.0 * nentries / elapsed_nsec);
+   vqf_print_stats(stdout, stats);
+
+   static latency_histogram all;
+   latency_print_header(stdout, timed ? "latency (ns, due)" : "latency (ns)");
+   for (int type = 0; type < VQF_TRACE_NUM_OPS; type++) {
+      latency_reset(&all);
+      for (uint32_t i = 0; i < nthreads; i++)
+         latency_merge(&all, &threads[i].latencies[type]);
+      latency_print(stdout, op_names[type], &all);
+   }
+
+   printf("%-20s %12s %12s\n", "results", "count", "diverged");
+   for (int type = 0; type < VQF_TRACE_NUM_OPS; type++) {
+      uint64_t count = 0, diverged = 0;
+      for (uint32_t i = 0; i < nthreads; i++) {
+         count += threads[i].counts[type];
+         diverged += threads[i].diverged[type];
+      }
+      if (count > 0)
+         printf("%-20s %12lu %12lu\n", op_names[type], count, diverged);
+   }
+}
+
+static void usage(const char *name) {
+   printf("%s [OPTIONS] trace\n"
+         "Options are:\n"
+         "  -n qbits       [ log_2 of the replay filter's capacity.  Default: the size\n"
+         "                   of the traced filter ]\n"
+         "  -p             [ replay each traced thread on a thread of its own.  Default\n"
+         "                   one thread in time order ]\n"
+         "  -T             [ issue each operation at its traced time.  Default full speed ]\n"
+         "  -S period      [ time one operation in period, a power of two.  Default %d ]\n"
+         "  -r nruns       [ repeat the replay on a fresh filter.  Default 1 ]\n"
+         "  -j resultfile  [ write the configuration and throughput as JSON, or CSV if it\n"
+         "                   ends in .csv ]\n",
+         name, LATENCY_SAMPLE_PERIOD);
+}
+
+int main(int argc, char **argv)
+{
+   uint64_t qbits = 0, nruns = 1, period = LATENCY_SAMPLE_PERIOD;
+   bool parallel = false, timed = false;
+   const char *resultfile = NULL;
+   int opt;
+   char *term = NULL;
+
+   while ((opt = getopt(argc, argv, "n:pTS:r:j:")) != -1) {
+      switch (opt) {
+         case 'n':
+            qbits = strtoull(optarg, &term, 10);
+            break;
+         case 'p':
+            parallel = true;
+            break;
+         case 'T':
+            timed = true;
+            break;
+         case 'S':
+            period = strtoull(optarg, &term, 10);
+            if (period == 0 || (period & (period - 1)) != 0) {
+               fprintf(stderr, "Argument to -S must be a power of two\n");
+               exit(1);
+            }
+            break;
+         case 'r':
+            nruns = strtoull(optarg, &term, 10);
+            break;
+         case 'j':
+            resultfile = optarg;
+            break;
+         default:
+            usage(argv[0]);
+            exit(1);
+      }
+      if (term != NULL && *term) {
+         fprintf(stderr, "Invalid argument to -%c: %s\n", opt, optarg);
+         usage(argv[0]);
+         exit(1);
+      }
+      term = NULL;
+   }
+   if (argc - optind != 1 || nruns == 0) {
+      usage(argv[0]);
+      exit(1);
+   }
+   const char *path = argv[optind];
+
+   vqf_trace_header header;
+   std::vector<vqf_trace_entry> entries;
+   if (!vqf_trace_read(path, &header, entries))
+      exit(EXIT_FAILURE);
+   if (entries.empty()) {
+      fprintf(stderr, "%s has no entries\n", path);
+      exit(EXIT_FAILURE);
+   }
+
+   uint32_t ntraced = 0;
+   uint64_t duration = 0;
+   for (uint64_t i = 0; i < entries.size(); i++) {
+      ntraced = std::max(ntraced, entries[i].thread + 1U);
+      duration = std::max(duration, entries[i].cycles);
+   }
+   printf("Trace: %lu operations from %u thread%s over %.3f seconds, on %lu slots\n",
+         entries.size(), ntraced, ntraced > 1 ? "s" : "",
+         duration * header.nsec_per_cycle / 1e9, header.nslots);
+
+   // vqf_init rounds up by a block, so the traced size is asked for one
+   // block short to get the same geometry back
+   uint64_t nslots = qbits > 0 ? 1ULL << qbits : header.nslots - QUQU_SLOTS_PER_BLOCK;
+   vqf_filter *filter;
+   if ((filter = vqf_init(nslots)) == NULL) {
+      fprintf(stderr, "Can't allocate vqf filter.");
+      exit(EXIT_FAILURE);
+   }
+   uint64_t range = filter->metadata.range, remainder_bits = filter->metadata.key_remainder_bits;
+   free(filter);
+   if (range != header.range) {
+      printf("Replay filter range %lu differs from the traced %lu; hashes are scaled "
+            "to it\n", range, header.range);
+      for (uint64_t i = 0; i < entries.size(); i++)
+         entries[i].hash = vqf_trace_rescale(entries[i].hash, header.range, range,
+               remainder_bits);
+   }
+
+   uint32_t nthreads = parallel ? ntraced : 1;
+   if (nthreads > 1 && !VQF_THREAD_SAFE) {
+      fprintf(stderr, "Build with THREAD=1 to replay more than one thread.\n");
+      exit(1);
+   }
+   printf("Filter kernels: %s tag shift, %s match\n", VQF_TAG_SHIFT_KERNEL, VQF_MATCH_KERNEL);
+
+   // calibrate the TSC before any thread paces itself with it
+   double timing = timed ? header.nsec_per_cycle / latency_nsec_per_cycle() : 0;
+   replay_thread *threads = new replay_thread[nthreads];
+   for (uint32_t i = 0; i < nthreads; i++) {
+      threads[i].timing = timing;
+      threads[i].sample_mask = period - 1;
+   }
+   if (parallel) {
+      for (uint64_t i = 0; i < entries.size(); i++)
+         threads[entries[i].thread].entries.push_back(entries[i]);
+   } else {
+      // entries of different threads are written in blocks; order them by time
+      std::stable_sort(entries.begin(), entries.end(),
+            [](const vqf_trace_entry& a, const vqf_trace_entry& b) {
+               return a.cycles < b.cycles;
+            });
+      threads[0].entries.swap(entries);
+   }
+   uint64_t nentries = 0;
+   for (uint32_t i = 0; i < nthreads; i++)
+      nentries += threads[i].entries.size();
+
+   bench_report results;
+   bench_report_config(&results, "program", "replay");
+   bench_report_config(&results, "point", "qbits");
+   bench_report_config(&results, "trace", path);
+   bench_report_config(&results, "nslots", nslots);
+   bench_report_config(&results, "tag_shift", VQF_TAG_SHIFT_KERNEL);
+   bench_report_config(&results, "tag_match", VQF_MATCH_KERNEL);
+   bench_report_config(&results, "threads", nthreads);
+   bench_report_config(&results, "timing", timed ? "traced" : "full speed");
+
+   for (uint64_t run = 0; run < nruns; run++) {
+      vqf_stats stats;
+      uint64_t elapsed_nsec = replay(threads, nthreads, nslots, &stats);
+      if (nruns > 1)
+         printf("Run %lu\n", run);
+      report(threads, nthreads, nentries, elapsed_nsec, timed, &stats);
+      bench_report_add(&results, "replay", 63 - __builtin_clzll(nslots), "Mops/s",
+            1000.0 * nentries / elapsed_nsec);
+   }
+   if (resultfile && !bench_report_write(&results, resultfile))
+      exit(EXIT_FAILURE);
+
+   delete[] threads;
+   return 0;
+}
@@ -15,133 +15,19 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <unistd.h>
 #include <immintrin.h>  // portable to all x86 compilers
 #include <tmmintrin.h>
 
 #include "vqf_filter.h"
-#include "vqf_precompute.h"
-
-
-#define TAG_BITS 8
-
-// ALT block check is set of 75% of the number of slots
-#if TAG_BITS == 8
-#define TAG_MASK 0xff
-#define QUQU_SLOTS_PER_BLOCK 28
-#define QUQU_BUCKETS_PER_BLOCK 36
-#define QUQU_CHECK_ALT 43
-#endif
-
-#ifdef VQF_USE_AVX
-// #ifdef __AVX512BW__
-extern __m512i SHUFFLE [];
-extern __m512i SHUFFLE_REMOVE [];
-extern __m512i SHUFFLE16 [];
-extern __m512i SHUFFLE_REMOVE16 [];
-#endif
-
-#define LOCK_MASK (1ULL << 63)
-#define UNLOCK_MASK ~(1ULL << 63)
-
-static inline void lock(vqf_block& block)
-{
-#ifdef ENABLE_THREADS
-   uint64_t *data;
-#if TAG_BITS == 8
-   data = block.md + 1;
-#elif TAG_BITS == 16
-   data = &block.md;
-#endif
-   while ((__sync_fetch_and_or(data, LOCK_MASK) & (1ULL << 63)) != 0) {}
-#endif
-}
-
-static inline void unlock(vqf_block& block)
-{
-#ifdef ENABLE_THREADS
-   uint64_t *data;
-#if TAG_BITS == 8
-   data = block.md + 1;
-#elif TAG_BITS == 16
-   data = &block.md;
-#endif
-   __sync_fetch_and_and(data, UNLOCK_MASK);
-#endif
-}
-
-static inline void lock_blocks(vqf_filter * restrict filter, uint64_t index1, uint64_t index2)  {
-#ifdef ENABLE_THREADS
-   if (index1 < index2) {
-      lock(filter->blocks[index1/QUQU_BUCKETS_PER_BLOCK]);
-      lock(filter->blocks[index2/QUQU_BUCKETS_PER_BLOCK]);
-   } else {
-      lock(filter->blocks[index2/QUQU_BUCKETS_PER_BLOCK]);
-      lock(filter->blocks[index1/QUQU_BUCKETS_PER_BLOCK]);
-   }
-#endif
-}
-
-static inline void unlock_blocks(vqf_filter * restrict filter, uint64_t index1, uint64_t index2)  {
-#ifdef ENABLE_THREADS
-   if (index1 < index2) {
-      unlock(filter->blocks[index1/QUQU_BUCKETS_PER_BLOCK]);
-      unlock(filter->blocks[index2/QUQU_BUCKETS_PER_BLOCK]);
-   } else {
-      unlock(filter->blocks[index2/QUQU_BUCKETS_PER_BLOCK]);
-      unlock(filter->blocks[index1/QUQU_BUCKETS_PER_BLOCK]);
-   }
-#endif
-}
-
-static inline int word_rank(uint64_t val) {
-   return __builtin_popcountll(val);
-}
-
-// Returns the position of the rank'th 1.  (rank = 0 returns the 1st 1)
-// Returns 64 if there are fewer than rank+1 1s.
-static inline uint64_t word_select(uint64_t val, int rank) {
-   val = _pdep_u64(one[rank], val);
-   return _tzcnt_u64(val);
-}
-
-// select(vec, 0) -> -1
-// select(vec, i) -> 128, if i > popcnt(vec)
-static inline int64_t select_128_old(__uint128_t vector, uint64_t rank) {
-   uint64_t lower_word = vector & 0xffffffffffffffff;
-   uint64_t lower_pdep = _pdep_u64(one[rank], lower_word);
-   //uint64_t lower_select = word_select(lower_word, rank);
-   if (lower_pdep != 0) {
-      //assert(rank < word_rank(lower_word));
-      return _tzcnt_u64(lower_pdep);
-   }
-   rank = rank - word_rank(lower_word);
-   uint64_t higher_word = vector >> 64;
-   return word_select(higher_word, rank) + 64;
-}
-
-static inline uint64_t lookup_64(uint64_t vector, uint64_t rank) {
-   uint64_t lower_return = _pdep_u64(one[rank], vector) >> rank << (sizeof(uint64_t)/2);
-   return lower_return;
-}
-
-static inline uint64_t lookup_128(uint64_t *vector, uint64_t rank) {
-   uint64_t lower_word = vector[0];
-   uint64_t lower_rank = word_rank(lower_word);
-   uint64_t lower_return = _pdep_u64(one[rank], lower_word) >> rank << sizeof(__uint128_t);
-   int64_t higher_rank = (int64_t)rank - lower_rank;
-   uint64_t higher_word = vector[1];
-   uint64_t higher_return = _pdep_u64(one[higher_rank], higher_word);
-   higher_return <<= (64 + sizeof(__uint128_t) - rank);
-   return lower_return + higher_return;
-}
-
-static inline int64_t select_64(uint64_t vector, uint64_t rank) {
-   return _tzcnt_u64(lookup_64(vector, rank));
-}
-
-static inline int64_t select_128(uint64_t *vector, uint64_t rank) {
-   return _tzcnt_u64(lookup_128(vector, rank));
-}
+#include "vqf_inline.h"
+#include "vqf_trace.h"
+#include "vqf_profile.h"
+#include "vqf_probes.h"
 
 //assumes little endian
 #if TAG_BITS == 8
@@ -157,7 +43,8 @@ void print_bits(uint64_t num, int numbits)
    }
    puts("");
 }
-void print_tags(uint16_t *tags, uint32_t size) {
+template <typename T>
+void print_tags(const T *tags, uint32_t size) {
    for (uint8_t i = 0; i < size; i++)
       printf("%d ", (uint32_t)tags[i]);
    printf("\n");
@@ -169,85 +56,10 @@ void print_block(vqf_filter *filter, uint64_t block_index) {
    print_bits(md, QUQU_BUCKETS_PER_BLOCK + QUQU_SLOTS_PER_BLOCK);
    printf("tags: ");
    print_tags(filter->blocks[block_index].tags, QUQU_SLOTS_PER_BLOCK);
-}
+#ifdef VQF_SPLIT_BLOCKS
+   printf("vals: ");
+   print_tags(filter->blocks[block_index].vals, QUQU_SLOTS_PER_BLOCK);
 #endif
-
-#ifdef VQF_USE_AVX
-// #ifdef __AVX512BW__
-#if TAG_BITS == 8
-static inline void update_tags_512(vqf_block * restrict block, uint8_t index, uint16_t tag) {
-   block->tags[27] = tag;	// add tag at the end
-
-   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
-   vector = _mm512_permutexvar_epi16(SHUFFLE16[index], vector);
-   _mm512_storeu_si512(reinterpret_cast<__m512i*>(block), vector);
-}
-
-static inline void remove_tags_512(vqf_block * restrict block, uint8_t index) {
-   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
-   vector = _mm512_permutexvar_epi16(SHUFFLE_REMOVE16[index], vector);
-   _mm512_storeu_si512(reinterpret_cast<__m512i*>(block), vector);
-}
-#endif
-#else
-#if TAG_BITS == 8
-
-static inline void update_tags_512(vqf_block * restrict block, uint8_t index, uint16_t tag) {
-   index -= 4;
-   memmove(&block->tags[index + 1], &block->tags[index], (sizeof(block->tags) / sizeof(block->tags[0]) - index - 1) * 2);
-   block->tags[index] = tag;
-}
-
-static inline void remove_tags_512(vqf_block * restrict block, uint8_t index) {
-   index -= 4;
-   memmove(&block->tags[index], &block->tags[index+1], (sizeof(block->tags) / sizeof(block->tags[0]) - index) * 2);
-}
-#endif
-#endif
-
-#if 0
-// Shuffle using AVX2 vector instruction. It turns out memmove is faster compared to AVX2.
-inline __m256i cross_lane_shuffle(const __m256i & value, const __m256i &
-      shuffle) 
-{ 
-   return _mm256_or_si256(_mm256_shuffle_epi8(value, _mm256_add_epi8(shuffle,
-               K[0])), 
-         _mm256_shuffle_epi8(_mm256_permute4x64_epi64(value, 0x4E),
-            _mm256_add_epi8(shuffle, K[1]))); 
-} 
-
-#define SHUFFLE_SIZE 32
-void shuffle_256(uint8_t * restrict source, __m256i shuffle) {
-   __m256i vector = _mm256_loadu_si256(reinterpret_cast<__m256i*>(source)); 
-
-   vector = cross_lane_shuffle(vector, shuffle); 
-   _mm256_storeu_si256(reinterpret_cast<__m256i*>(source), vector); 
-} 
-
-static inline void update_tags_256(uint8_t * restrict block, uint8_t index,
-      uint8_t tag) {
-   index = index + sizeof(__uint128_t);	// offset index based on md field.
-   block[63] = tag;	// add tag at the end
-   shuffle_256(block + SHUFFLE_SIZE, RM[index]); // right block shuffle
-   if (index < SHUFFLE_SIZE) {		// if index lies in the left block
-      std::swap(block[31], block[32]);	// move tag to the end of left block
-      shuffle_256(block, LM[index]);	// shuffle left block
-   }
-}
-#endif
-
-#if TAG_BITS == 8
-static inline void update_md(uint64_t *md, uint8_t index) {
-   *md = _pdep_u64(*md, low_order_pdep_table[index]);
-}
-
-static inline void remove_md(uint64_t *md, uint8_t index) {
-   *md = _pext_u64(*md, low_order_pdep_table[index]) | (1ULL << 63);
-}
-
-// number of 0s in the metadata is the number of tags.
-static inline uint64_t get_block_free_space(uint64_t vector) {
-   return word_rank(vector);
 }
 #endif
 
@@ -260,8 +72,9 @@ vqf_filter * vqf_init(uint64_t nslots) {
    uint64_t total_blocks = (nslots + QUQU_SLOTS_PER_BLOCK)/QUQU_SLOTS_PER_BLOCK;
    uint64_t total_size_in_bytes = sizeof(vqf_block) * total_blocks;
 
-   filter = (vqf_filter *)malloc(sizeof(*filter) + total_size_in_bytes);
-   printf("Size: %ld\n",total_size_in_bytes);
+   // the count shards and the blocks are cache-line aligned
+   if (posix_memalign((void **)&filter, 64, sizeof(*filter) + total_size_in_bytes) != 0)
+      filter = NULL;
    assert(filter);
 
    filter->metadata.total_size_in_bytes = total_size_in_bytes;
@@ -275,6 +88,7 @@ vqf_filter * vqf_init(uint64_t nslots) {
    filter->metadata.range = total_blocks * QUQU_BUCKETS_PER_BLOCK * (1ULL << filter->metadata.key_remainder_bits);
    filter->metadata.nblocks = total_blocks;
    filter->metadata.nelts = 0;
+   memset(filter->metadata.counts, 0, sizeof(filter->metadata.counts));
 
    // memset to 1
 #if TAG_BITS == 8
@@ -288,330 +102,675 @@ vqf_filter * vqf_init(uint64_t nslots) {
 }
 
 
-#ifdef VQF_USE_AVX
-// #ifdef __AVX512BW__
-static inline uint64_t generate_match_mask(vqf_filter * restrict filter, uint64_t tag, uint64_t block_index){
-
-   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
-   uint64_t offset = block_index % QUQU_BUCKETS_PER_BLOCK;
-
-   //load 32 8 bit copies of the tag
-   __m256i bcast = _mm256_set1_epi8(tag);
-
-   // //and load the block as a 32 16 bit (val, key) pairs
-
-   vqf_block * block = &filter->blocks[index];
-
-   __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
-   //__m512i block =  _mm512_loadu_si512(reinterpret_cast<__m512i*>(&filter->blocks[index]));
-
-   //__m512i block = _mm512_loadu_epi16(&filter->blocks[index]);
-   // //truncate tags - this cuts off the upper 8 bits of every q6 bit dag.
-   __m256i shrunken_tags = _mm512_cvtepi16_epi8(block);
-
-   volatile __mmask32 result = _mm256_cmpeq_epi8_mask(bcast, shrunken_tags);
-
-   uint64_t start = offset != 0 ? lookup_64(filter->blocks[index].md, offset -
-         1) : one[0] << (sizeof(uint64_t)/2);
-   uint64_t end = lookup_64(filter->blocks[index].md, offset);
-
-   uint64_t mask = end - start;
-   return (mask & result);
-
-   //return 0;
-
-
+// The page size backing an allocation of bytes: the THP size if transparent
+// huge pages are always on and the allocation can hold one.
+static uint64_t backing_page_size(uint64_t bytes) {
+   uint64_t page = sysconf(_SC_PAGESIZE), huge = 0;
+   char mode[128] = "";
+   FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+   if (fp != NULL) {
+      if (fgets(mode, sizeof(mode), fp) == NULL)
+         mode[0] = '\0';
+      fclose(fp);
+   }
+   fp = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+   if (fp != NULL) {
+      if (fscanf(fp, "%lu", &huge) != 1)
+         huge = 0;
+      fclose(fp);
+   }
+   if (strstr(mode, "[always]") != NULL && huge > page && bytes >= huge)
+      return huge;
+   return page;
+}
+
+uint64_t vqf_size(const vqf_filter * restrict filter) {
+   int64_t size = 0;
+   for (int i = 0; i < VQF_COUNT_SHARDS; i++)
+      size += __atomic_load_n(&filter->metadata.counts[i].count, __ATOMIC_RELAXED);
+   return size > 0 ? size : 0;
+}
+
+double vqf_load_factor(const vqf_filter * restrict filter) {
+   return 1.0 * vqf_size(filter) / filter->metadata.nslots;
+}
+
+// One thread's share of a scan over the blocks.
+typedef struct block_range {
+   pthread_t thread;
+   bool threaded;
+   const vqf_block *blocks;
+   uint64_t start;
+   uint64_t end;
+} block_range;
+
+// Splits nblocks into ranges.size() ranges and runs scan on each. The
+// calling thread scans the first range, and any range whose thread could not
+// be started. Range must begin with a block_range.
+template <typename Range>
+static void scan_blocks(std::vector<Range>& ranges, const vqf_block *blocks, uint64_t nblocks,
+      void *(*scan)(void *)) {
+   uint32_t nthreads = ranges.size();
+   for (uint32_t i = 0; i < nthreads; i++) {
+      block_range *r = &ranges[i];
+      r->blocks = blocks;
+      r->start = nblocks * i / nthreads;
+      r->end = nblocks * (i + 1) / nthreads;
+      r->threaded = i > 0 && pthread_create(&r->thread, NULL, scan, &ranges[i]) == 0;
+   }
+   for (uint32_t i = 0; i < nthreads; i++) {
+      if (ranges[i].threaded)
+         pthread_join(ranges[i].thread, NULL);
+      else
+         scan(&ranges[i]);
+   }
 }
 
-#else
-
-static inline uint64_t generate_match_mask(vqf_filter * restrict filter, uint64_t tag, uint64_t block_index){
-
-   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
-   uint64_t offset = block_index % QUQU_BUCKETS_PER_BLOCK;
-
-   //load 32 8 bit copies of the tag
-   //__m256i bcast = _mm256_set1_epi8(tag);
-
-   // //and load the block as a 32 16 bit (val, key) pairs
-
-   vqf_block * block = &filter->blocks[index];
-
-   uint32_t result = 0;
-
-   for (int i=0; i <  QUQU_SLOTS_PER_BLOCK; i++){
-
-      if ((block->tags[i] & TAG_MASK) == tag){
-
-         uint32_t mask = (1UL << i);
-
-         result = result | mask;
+static uint32_t scan_threads(uint64_t nblocks, uint32_t nthreads) {
+   if (nthreads == 0)
+      nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nthreads > nblocks)
+      nthreads = nblocks > 0 ? nblocks : 1;
+   return nthreads;
+}
+
+typedef struct count_range : block_range {
+   uint64_t count;
+} count_range;
+
+// Each tag is a 0 in the 63 metadata bits below the lock bit
+static void *count_range_entries(void *arg) {
+   count_range *r = (count_range *)arg;
+   uint64_t free_bits = 0;
+   for (uint64_t i = r->start; i < r->end; i++)
+      free_bits += __builtin_popcountll(r->blocks[i].md & UNLOCK_MASK);
+   r->count = 63 * (r->end - r->start) - free_bits;
+   return NULL;
+}
+
+uint64_t vqf_count_entries(const vqf_filter * restrict filter, uint32_t nthreads) {
+   uint64_t nblocks = filter->metadata.nblocks;
+   std::vector<count_range> ranges(scan_threads(nblocks, nthreads));
+   scan_blocks(ranges, filter->blocks, nblocks, count_range_entries);
+   uint64_t count = 0;
+   for (size_t i = 0; i < ranges.size(); i++)
+      count += ranges[i].count;
+   return count;
+}
+
+typedef struct occupancy_range : block_range {
+   vqf_occupancy occupancy;
+   uint64_t free_squares;
+   // tags in each heatmap cell this range overlaps
+   uint64_t nblocks;
+   uint32_t ncells;
+   std::vector<uint64_t> cell_tags;
+} occupancy_range;
+
+#define FULL_FREE_SLOTS QUQU_FULL_FREE_SLOTS(VQF_THREAD_SAFE)
+
+static void *scan_range_occupancy(void *arg) {
+   occupancy_range *r = (occupancy_range *)arg;
+   vqf_occupancy *o = &r->occupancy;
+   for (uint64_t i = r->start; i < r->end; i++) {
+      uint64_t md = r->blocks[i].md;
+      uint64_t free_slots = vqf::block_free_slots(md);
+      o->free_slots[free_slots]++;
+      r->free_squares += free_slots * free_slots;
+      // a bucket's run is the 0s before its 1; the 1s after the last
+      // bucket's are free slots. Bit 63 is the last bucket end of a full
+      // single-threaded block, and a free slot or the lock otherwise.
+      int64_t prev = -1;
+      uint64_t ends = md | (1ULL << 63);
+      for (int b = 0; b < QUQU_BUCKETS_PER_BLOCK; b++, ends &= ends - 1) {
+         int64_t end = __builtin_ctzll(ends);
+         o->run_lengths[end - prev - 1]++;
+         prev = end;
       }
-
+      if (r->ncells > 0)
+         r->cell_tags[i * r->ncells / r->nblocks] += QUQU_SLOTS_PER_BLOCK - free_slots;
+   }
+   return NULL;
+}
+
+void vqf_get_occupancy(const vqf_filter * restrict filter, uint32_t nthreads,
+      vqf_occupancy *occupancy, double *heatmap, uint32_t ncells) {
+   uint64_t nblocks = filter->metadata.nblocks;
+   if (heatmap == NULL)
+      ncells = 0;
+   std::vector<occupancy_range> ranges(scan_threads(nblocks, nthreads));
+   for (size_t i = 0; i < ranges.size(); i++) {
+      memset(&ranges[i].occupancy, 0, sizeof(vqf_occupancy));
+      ranges[i].free_squares = 0;
+      ranges[i].nblocks = nblocks;
+      ranges[i].ncells = ncells;
+      ranges[i].cell_tags.assign(ncells, 0);
+   }
+   scan_blocks(ranges, filter->blocks, nblocks, scan_range_occupancy);
+
+   vqf_occupancy *o = occupancy;
+   memset(o, 0, sizeof(*o));
+   o->nblocks = nblocks;
+   uint64_t free_squares = 0;
+   for (size_t i = 0; i < ranges.size(); i++) {
+      for (int j = 0; j < VQF_OCCUPANCY_BINS; j++) {
+         o->free_slots[j] += ranges[i].occupancy.free_slots[j];
+         o->run_lengths[j] += ranges[i].occupancy.run_lengths[j];
+      }
+      free_squares += ranges[i].free_squares;
+   }
+   uint64_t free_total = 0, nbuckets = 0;
+   for (int j = 0; j < VQF_OCCUPANCY_BINS; j++) {
+      nbuckets += o->run_lengths[j];
+      free_total += j * o->free_slots[j];
+      if (o->run_lengths[j] > 0)
+         o->longest_run = j;
+      if (j <= FULL_FREE_SLOTS + VQF_NEAR_FULL_SLOTS)
+         o->near_full_blocks += o->free_slots[j];
+      if (j + QUQU_BUCKETS_PER_BLOCK < QUQU_CHECK_ALT)
+         o->alt_blocks += o->free_slots[j];
+   }
+   assert(nbuckets == nblocks * QUQU_BUCKETS_PER_BLOCK);
+   o->full_blocks = o->free_slots[FULL_FREE_SLOTS];
+   o->entries = QUQU_SLOTS_PER_BLOCK * nblocks - free_total;
+   if (nblocks > 0) {
+      o->mean_free = 1.0 * free_total / nblocks;
+      o->stddev_free = sqrt(std::max(0.0, 1.0 * free_squares / nblocks - o->mean_free * o->mean_free));
    }
 
-   // __m512i vector = _mm512_loadu_si512(reinterpret_cast<__m512i*>(block));
-   // //__m512i block =  _mm512_loadu_si512(reinterpret_cast<__m512i*>(&filter->blocks[index]));
-
-   // //__m512i block = _mm512_loadu_epi16(&filter->blocks[index]);
-   // // //truncate tags - this cuts off the upper 8 bits of every q6 bit dag.
-   // __m256i shrunken_tags = _mm512_cvtepi16_epi8(block);
-
-   // volatile __mmask32 result = _mm256_cmpeq_epi8_mask(bcast, shrunken_tags);
-
-   uint64_t start = offset != 0 ? lookup_64(filter->blocks[index].md, offset -
-         1) : one[0] << (sizeof(uint64_t)/2);
-   uint64_t end = lookup_64(filter->blocks[index].md, offset);
-
-   uint64_t mask = (end - start) >> 4;
-
- 
-   //printf("Tag is %llx, Mask is %llx, result is %llx, output %llx\n", tag, mask, result, mask & result);
-
-
-   return (mask & result);
-
-   //return 0;
-
-
+   for (uint32_t c = 0; c < ncells; c++) {
+      uint64_t tags = 0;
+      for (size_t i = 0; i < ranges.size(); i++)
+         tags += ranges[i].cell_tags[c];
+      // the blocks i with i * ncells / nblocks == c
+      uint64_t first = (c * nblocks + ncells - 1) / ncells;
+      uint64_t last = ((c + 1) * nblocks + ncells - 1) / ncells;
+      heatmap[c] = last > first ? 1.0 * tags / (QUQU_SLOTS_PER_BLOCK * (last - first)) : 0;
+   }
 }
 
-
-
-#endif
-
-bool vqf_insert(vqf_filter * restrict filter, uint64_t hash){
-
-   uint8_t default_val = 0;
-
-   return vqf_insert_val(filter, hash, default_val);
-
+void vqf_print_occupancy(FILE *fp, const vqf_occupancy *o) {
+   double n = o->nblocks > 0 ? o->nblocks : 1;
+   fprintf(fp, "Blocks: %lu, %lu entries, free slots per block mean %.2f stddev %.2f\n",
+         o->nblocks, o->entries, o->mean_free, o->stddev_free);
+   fprintf(fp, "Full %.4f%%, near full (<= %d free) %.4f%%, checking the alternate %.2f%%; "
+         "longest run %lu\n", 100 * o->full_blocks / n, FULL_FREE_SLOTS + VQF_NEAR_FULL_SLOTS,
+         100 * o->near_full_blocks / n, 100 * o->alt_blocks / n, o->longest_run);
+   uint64_t nbuckets = 0, most = 1;
+   for (int j = 0; j < VQF_OCCUPANCY_BINS; j++) {
+      nbuckets += o->run_lengths[j];
+      most = std::max(most, o->free_slots[j]);
+   }
+   fprintf(fp, "%4s %12s %8s %12s %8s\n", "n", "free=n", "%", "run=n", "%");
+   for (int j = 0; j < VQF_OCCUPANCY_BINS; j++) {
+      if (o->free_slots[j] == 0 && o->run_lengths[j] == 0)
+         continue;
+      fprintf(fp, "%4d %12lu %8.3f %12lu %8.3f ", j, o->free_slots[j], 100 * o->free_slots[j] / n,
+            o->run_lengths[j], nbuckets ? 100.0 * o->run_lengths[j] / nbuckets : 0);
+      for (uint64_t k = 0; k < 30 * o->free_slots[j] / most; k++)
+         fputc('#', fp);
+      fputc('\n', fp);
+   }
 }
 
-// If the item goes in the i'th slot (starting from 0) in the block then
-// find the i'th 0 in the metadata, insert a 1 after that and shift the rest
-// by 1 bit.
-// Insert the new tag at the end of its run and shift the rest by 1 slot.
-bool vqf_insert_val(vqf_filter * restrict filter, uint64_t hash, uint8_t val) {
-   vqf_metadata * restrict metadata           = &filter->metadata;
-   vqf_block    * restrict blocks             = filter->blocks;
-   uint64_t                 key_remainder_bits = metadata->key_remainder_bits;
-   uint64_t                 range              = metadata->range;
-
-
-
-   uint64_t block_index = hash >> key_remainder_bits;
-   lock(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
-#if TAG_BITS == 8
-   uint64_t * block_md = &blocks[block_index/QUQU_BUCKETS_PER_BLOCK].md;
-   uint64_t block_free = get_block_free_space(*block_md);
-#endif
-
-   uint64_t val_shifted = ((uint64_t) val) << 8;
-   uint64_t tag = hash & TAG_MASK;
-
-
-   uint64_t stored_tag = tag | val_shifted;
-
-   if ((stored_tag & ((1U << 16) -1)) != stored_tag){
-
-      printf("overflow\n");
+void vqf_print_heatmap(FILE *fp, const double *heatmap, uint32_t ncells, uint32_t width) {
+   static const char ramp[] = " .:-=+*#%@";
+   const int levels = sizeof(ramp) - 1;
+   if (width == 0)
+      width = 64;
+   fprintf(fp, "Load by address, %u cells: ' ' < 10%% ... '@' >= 90%%\n", ncells);
+   for (uint32_t row = 0; row < ncells; row += width) {
+      fprintf(fp, "%5.1f%% |", 100.0 * row / ncells);
+      for (uint32_t c = row; c < ncells && c < row + width; c++)
+         fputc(ramp[std::min(levels - 1, std::max(0, (int)(heatmap[c] * levels)))], fp);
+      fputs("|\n", fp);
    }
+}
 
-
-   //block inidices are not based on hash
-   uint64_t alt_block_index = ((hash ^ (tag * 0x5bd1e995)) % range) >> key_remainder_bits;
-
-   __builtin_prefetch(&blocks[alt_block_index/QUQU_BUCKETS_PER_BLOCK]);
-
-   if (block_free < QUQU_CHECK_ALT && block_index/QUQU_BUCKETS_PER_BLOCK != alt_block_index/QUQU_BUCKETS_PER_BLOCK) {
-      unlock(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
-      lock_blocks(filter, block_index, alt_block_index);
-#if TAG_BITS == 8
-      uint64_t *alt_block_md = &blocks[alt_block_index/QUQU_BUCKETS_PER_BLOCK].md;
-      uint64_t alt_block_free = get_block_free_space(*alt_block_md);
+void vqf_get_stats(const vqf_filter * restrict filter, vqf_stats *stats) {
+   const vqf_metadata *m = &filter->metadata;
+   stats->block_bytes = sizeof(vqf_block);
+   stats->nblocks = m->nblocks;
+   stats->nslots = m->nslots;
+   stats->filter_bytes = sizeof(*filter) + m->total_size_in_bytes;
+
+   // malloc's padding, then rounded out to the pages the block spans
+   uint64_t usable = malloc_usable_size((void *)filter);
+   stats->page_size = backing_page_size(usable);
+   uint64_t start = (uintptr_t)filter & ~(stats->page_size - 1);
+   uint64_t end = ((uintptr_t)filter + usable + stats->page_size - 1) & ~(stats->page_size - 1);
+   stats->allocated_bytes = end - start;
+
+   stats->entries = vqf_count_entries(filter, 1);
+   stats->size = vqf_size(filter);
+   stats->load_factor = 1.0 * stats->entries / m->nslots;
+   stats->bits_per_entry = stats->entries ? 8.0 * stats->allocated_bytes / stats->entries : 0;
+
+   // A negative lookup compares its tag with the tags of one bucket in each
+   // of its two blocks, and each compare matches with probability 2^-r.
+   double tags_per_bucket = 1.0 * stats->entries / (m->nblocks * QUQU_BUCKETS_PER_BLOCK);
+   stats->fp_rate = 1 - pow(1 - pow(2, -(double)m->key_remainder_bits), 2 * tags_per_bucket);
+}
+
+void vqf_print_stats(FILE *fp, const vqf_stats *stats) {
+   fprintf(fp, "Filter: %lu blocks of %lu bytes, %lu slots, %lu bytes (%lu allocated in "
+         "%lu-byte pages)\n", stats->nblocks, stats->block_bytes, stats->nslots,
+         stats->filter_bytes, stats->allocated_bytes, stats->page_size);
+   fprintf(fp, "Entries: %lu (vqf_size %lu), load factor %.4f, %.2f bits/entry, estimated FP "
+         "rate %.6f\n", stats->entries, stats->size, stats->load_factor, stats->bits_per_entry,
+         stats->fp_rate);
+}
+
+bool vqf_get_events(vqf_events *events) {
+   memset(events, 0, sizeof(*events));
+#ifdef VQF_EVENT_COUNTERS
+   const int nfields = sizeof(vqf_events) / sizeof(uint64_t);
+   uint64_t *sum = (uint64_t *)events;
+   for (vqf::event_record *r = __atomic_load_n(&vqf::event_counters<>::head, __ATOMIC_ACQUIRE);
+         r != NULL; r = r->next) {
+      const uint64_t *counts = (const uint64_t *)&r->events;
+      for (int i = 0; i < nfields; i++)
+         sum[i] += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+   }
+   return true;
+#else
+   return false;
 #endif
-      // pick the least loaded block
-      if (alt_block_free > block_free) {
-         unlock(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
-         block_index = alt_block_index;
-         block_md = alt_block_md;
-      } else if (block_free == QUQU_BUCKETS_PER_BLOCK) {
-         unlock_blocks(filter, block_index, alt_block_index);
-         fprintf(stderr, "vqf filter is full.");
-         return false;
-         //exit(EXIT_FAILURE);
-      } else {
-         unlock(blocks[alt_block_index/QUQU_BUCKETS_PER_BLOCK]);
-      }
+}
 
+static double share(uint64_t part, uint64_t whole) {
+   return whole ? 100.0 * part / whole : 0;
+}
+
+void vqf_print_events(FILE *fp, const vqf_events *e) {
+   fprintf(fp, "Inserts: %lu, alternate checked %lu (%.2f%%), alternate chosen %lu (%.2f%%), "
+         "failed %lu\n", e->inserts, e->insert_alt_checks, share(e->insert_alt_checks, e->inserts),
+         e->insert_alt_chosen, share(e->insert_alt_chosen, e->inserts), e->insert_failures);
+   fprintf(fp, "Lookups: %lu, second block probed %lu (%.2f%%); removes: %lu, second block "
+         "probed %lu (%.2f%%)\n", e->lookups, e->lookup_alt_probes,
+         share(e->lookup_alt_probes, e->lookups), e->removes, e->remove_alt_probes,
+         share(e->remove_alt_probes, e->removes));
+   fprintf(fp, "Match masks: %lu, %.4f tags per mask\n", e->match_masks,
+         e->match_masks ? 1.0 * e->matched_tags / e->match_masks : 0);
+}
+
+// Tracing (vqf_trace.h). Each thread fills its own buffer, so recording
+// takes no lock until a buffer is written out.
+#define TRACE_BUFFER_ENTRIES 4096
+
+vqf_filter *vqf_traced_filter = NULL;
+
+struct trace_buffer {
+   vqf_trace_entry *entries;
+   uint32_t n;
+   uint16_t thread;
+   // the trace the entries belong to; 0 before the thread first records
+   uint64_t generation;
+   ~trace_buffer();
+};
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_fp;
+static uint64_t trace_generation;
+static uint64_t trace_start_cycles;
+static struct timespec trace_start_time;
+static uint32_t trace_next_thread;
+static uint64_t trace_nentries;
+static std::vector<trace_buffer *> trace_buffers;
+static thread_local trace_buffer trace_local;
+
+// Called with trace_lock held. Entries of a finished trace are dropped.
+static void trace_flush(trace_buffer *b) {
+   if (b->generation == trace_generation && trace_fp != NULL && b->n > 0) {
+      fwrite(b->entries, sizeof(vqf_trace_entry), b->n, trace_fp);
+      trace_nentries += b->n;
    }
+   b->n = 0;
+}
+
+// Threads that exit before the trace stops write out their own entries.
+trace_buffer::~trace_buffer() {
+   if (entries == NULL)
+      return;
+   pthread_mutex_lock(&trace_lock);
+   trace_flush(this);
+   trace_buffers.erase(std::find(trace_buffers.begin(), trace_buffers.end(), this));
+   pthread_mutex_unlock(&trace_lock);
+   free(entries);
+}
+
+static void trace_attach(trace_buffer *b) {
+   pthread_mutex_lock(&trace_lock);
+   if (b->entries == NULL) {
+      b->entries = (vqf_trace_entry *)malloc(TRACE_BUFFER_ENTRIES * sizeof(vqf_trace_entry));
+      assert(b->entries);
+      trace_buffers.push_back(b);
+   }
+   b->n = 0;
+   b->generation = trace_generation;
+   b->thread = trace_next_thread++;
+   pthread_mutex_unlock(&trace_lock);
+}
 
-   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
-   uint64_t offset = block_index % QUQU_BUCKETS_PER_BLOCK;
-
-
-   uint64_t slot_index = select_64(*block_md, offset);
-   uint64_t select_index = slot_index + offset - (sizeof(uint64_t)/2);
-
-   /*printf("index: %ld tag: %ld offset: %ld\n", index, tag, offset);*/
-   /*print_block(filter, index);*/
-
-   update_tags_512(&blocks[index], slot_index,stored_tag);
-   update_md(block_md, select_index);
-   /*print_block(filter, index);*/
-   unlock(blocks[block_index/QUQU_BUCKETS_PER_BLOCK]);
+bool vqf_trace_start(vqf_filter *filter, const char *path) {
+   pthread_mutex_lock(&trace_lock);
+   if (trace_fp != NULL) {
+      pthread_mutex_unlock(&trace_lock);
+      fprintf(stderr, "A vqf trace is already running\n");
+      return false;
+   }
+   if ((trace_fp = fopen(path, "wb")) == NULL) {
+      pthread_mutex_unlock(&trace_lock);
+      perror(path);
+      return false;
+   }
+   // the header is written again with the totals when the trace stops
+   vqf_trace_header header;
+   memset(&header, 0, sizeof(header));
+   fwrite(&header, sizeof(header), 1, trace_fp);
+   trace_generation++;
+   trace_next_thread = 0;
+   trace_nentries = 0;
+   clock_gettime(CLOCK_MONOTONIC, &trace_start_time);
+   trace_start_cycles = __rdtsc();
+   __atomic_store_n(&vqf_traced_filter, filter, __ATOMIC_RELEASE);
+   pthread_mutex_unlock(&trace_lock);
    return true;
 }
 
-static inline bool remove_tags(vqf_filter * restrict filter, uint64_t tag,
-      uint64_t block_index) {
-   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
-   uint64_t offset = block_index % QUQU_BUCKETS_PER_BLOCK;
-
-   uint64_t check_indexes = generate_match_mask(filter, tag, block_index);
-
-   
-   if (check_indexes != 0) { // remove the first available tag
-      vqf_block    * restrict blocks             = filter->blocks;
-      uint64_t remove_index = __builtin_ctzll(check_indexes);
-      remove_tags_512(&blocks[index], remove_index);
-
-      remove_index = remove_index + offset - sizeof(uint64_t);
-      uint64_t *block_md = &blocks[block_index / QUQU_BUCKETS_PER_BLOCK].md;
-      remove_md(block_md, remove_index);
-
-      return true;
-   } else
+bool vqf_trace_stop(void) {
+   pthread_mutex_lock(&trace_lock);
+   vqf_filter *filter = vqf_traced_filter;
+   if (trace_fp == NULL) {
+      pthread_mutex_unlock(&trace_lock);
       return false;
+   }
+   __atomic_store_n(&vqf_traced_filter, (vqf_filter *)NULL, __ATOMIC_RELEASE);
+   for (size_t i = 0; i < trace_buffers.size(); i++)
+      trace_flush(trace_buffers[i]);
+
+   struct timespec end_time;
+   clock_gettime(CLOCK_MONOTONIC, &end_time);
+   uint64_t cycles = __rdtsc() - trace_start_cycles;
+   double nsec = 1e9 * (end_time.tv_sec - trace_start_time.tv_sec) +
+      (end_time.tv_nsec - trace_start_time.tv_nsec);
+
+   vqf_trace_header header;
+   memcpy(header.magic, VQF_TRACE_MAGIC, sizeof(header.magic));
+   header.version = VQF_TRACE_VERSION;
+   header.entry_size = sizeof(vqf_trace_entry);
+   header.nslots = filter->metadata.nslots;
+   header.range = filter->metadata.range;
+   header.nentries = trace_nentries;
+   header.nsec_per_cycle = cycles > 0 ? nsec / cycles : 1;
+   bool ok = fseek(trace_fp, 0, SEEK_SET) == 0 &&
+      fwrite(&header, sizeof(header), 1, trace_fp) == 1;
+   ok = fclose(trace_fp) == 0 && ok;
+   trace_fp = NULL;
+   pthread_mutex_unlock(&trace_lock);
+   return ok;
+}
+
+void vqf_trace_record(vqf_filter *filter, uint8_t op, uint64_t hash, uint8_t value,
+      bool result) {
+   if (filter != __atomic_load_n(&vqf_traced_filter, __ATOMIC_ACQUIRE))
+      return;
+   trace_buffer *b = &trace_local;
+   if (b->generation != __atomic_load_n(&trace_generation, __ATOMIC_RELAXED))
+      trace_attach(b);
+   vqf_trace_entry *e = &b->entries[b->n++];
+   e->cycles = __rdtsc() - trace_start_cycles;
+   e->hash = hash;
+   e->thread = b->thread;
+   e->op = op | (result ? VQF_TRACE_RESULT : 0);
+   e->value = value;
+   if (b->n == TRACE_BUFFER_ENTRIES) {
+      pthread_mutex_lock(&trace_lock);
+      trace_flush(b);
+      pthread_mutex_unlock(&trace_lock);
+   }
 }
 
-bool vqf_remove(vqf_filter * restrict filter, uint64_t hash) {
-   vqf_metadata * restrict metadata           = &filter->metadata;
-   uint64_t                 key_remainder_bits = metadata->key_remainder_bits;
-   uint64_t                 range              = metadata->range;
-
-   uint64_t block_index = hash >> key_remainder_bits;
-   uint64_t tag = hash & TAG_MASK;
-   uint64_t alt_block_index = ((hash ^ (tag * 0x5bd1e995)) % range) >> key_remainder_bits;
-
-   __builtin_prefetch(&filter->blocks[alt_block_index / QUQU_BUCKETS_PER_BLOCK]);
-
-   return remove_tags(filter, tag, block_index) || remove_tags(filter, tag, alt_block_index);
+// Sampling profiler (vqf_profile.h). A ring's owner writes a sample and then
+// publishes it by advancing head; readers copy the ring and then keep only
+// the samples the owner cannot have overwritten since they read head.
+uint32_t vqf_profile_period = 0;
+
+struct profile_ring {
+   vqf_profile_sample samples[VQF_PROFILE_RING_SAMPLES];
+   uint64_t head;             // samples ever written
+   uint64_t min_head;         // head at vqf_profile_start
+   uint16_t number;
+   bool owned;
+};
+
+struct profile_owner {
+   profile_ring *ring;
+   uint32_t countdown;        // operations until the next sample
+   uint64_t rand_state;
+   ~profile_owner();
+};
+
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<profile_ring *> profile_rings;
+static uint64_t profile_start_cycles;
+static uint32_t profile_last_period;
+static struct timespec profile_start_time;
+static thread_local profile_owner profile_local;
+
+// The ring and its samples stay for readers; the next new thread takes it.
+profile_owner::~profile_owner() {
+   if (ring != NULL)
+      __atomic_store_n(&ring->owned, false, __ATOMIC_RELEASE);
+}
+
+static profile_ring *profile_attach(void) {
+   profile_ring *r = NULL;
+   pthread_mutex_lock(&profile_lock);
+   for (size_t i = 0; i < profile_rings.size() && r == NULL; i++)
+      if (!__atomic_load_n(&profile_rings[i]->owned, __ATOMIC_ACQUIRE))
+         r = profile_rings[i];
+   if (r == NULL) {
+      r = (profile_ring *)calloc(1, sizeof(profile_ring));
+      assert(r);
+      r->number = profile_rings.size();
+      profile_rings.push_back(r);
+   }
+   r->owned = true;
+   pthread_mutex_unlock(&profile_lock);
+   profile_local.rand_state = ((uintptr_t)&profile_local ^ __rdtsc()) | 1;
+   return profile_local.ring = r;
+}
+
+void vqf_profile_start(uint32_t period) {
+   pthread_mutex_lock(&profile_lock);
+   clock_gettime(CLOCK_MONOTONIC, &profile_start_time);
+   profile_start_cycles = __rdtsc();
+   profile_last_period = period > 0 ? period : 1;
+   for (size_t i = 0; i < profile_rings.size(); i++) {
+      profile_ring *r = profile_rings[i];
+      __atomic_store_n(&r->min_head, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE),
+            __ATOMIC_RELAXED);
+   }
+   __atomic_store_n(&vqf_profile_period, profile_last_period, __ATOMIC_RELEASE);
+   pthread_mutex_unlock(&profile_lock);
 }
 
-
-static inline bool check_tags(vqf_filter * restrict filter, uint64_t tag,
-      uint64_t block_index) {
-   //uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
-   //uint64_t offset = block_index % QUQU_BUCKETS_PER_BLOCK;
-
-
-
-
-   return (generate_match_mask(filter, tag, block_index) != 0);
+void vqf_profile_stop(void) {
+   __atomic_store_n(&vqf_profile_period, 0, __ATOMIC_RELEASE);
 }
 
-
-static inline bool retrieve_value(vqf_filter * restrict filter, uint64_t tag, uint64_t block_index, uint8_t & val){
-
-   uint64_t mask = generate_match_mask(filter, tag, block_index);
-
-   uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
-
-
-   int first_set = __builtin_ffs(mask) -1;
-   if (first_set == -1){
-      //not found
+// Gaps between samples are uniform in [1, 2 * period - 1], period on average.
+bool vqf_profile_tick(uint64_t *start) {
+   profile_owner *o = &profile_local;
+   if (o->countdown > 1) {
+      o->countdown--;
       return false;
-   } else {
-
-      //move 8 bytes ahead on the first set bit
-      // to account for the metadata.
-      uint16_t pair = filter->blocks[index].tags[first_set];
-
-      val = pair >> 8;
-      return true;
-
    }
+   if (o->ring == NULL)
+      profile_attach();
+   uint32_t period = __atomic_load_n(&vqf_profile_period, __ATOMIC_RELAXED);
+   o->rand_state ^= o->rand_state << 13;
+   o->rand_state ^= o->rand_state >> 7;
+   o->rand_state ^= o->rand_state << 17;
+   o->countdown = period > 1 ? 1 + o->rand_state % (2 * period - 1) : 1;
+   *start = __rdtsc();
+   return true;
+}
 
+static uint8_t profile_block_free(const vqf_filter *filter, uint64_t block) {
+   return vqf::block_free_slots(__atomic_load_n(&filter->blocks[block].md, __ATOMIC_RELAXED));
+}
+
+void vqf_profile_record(const vqf_filter *filter, uint8_t op, uint64_t hash, bool result,
+      uint64_t start) {
+   uint64_t end = __rdtsc();
+   profile_ring *r = profile_local.ring;
+   if (r == NULL)
+      r = profile_attach();
+   vqf::view v = vqf::make_view((vqf_filter *)filter);
+   uint64_t head = r->head;
+   vqf_profile_sample *s = &r->samples[head % VQF_PROFILE_RING_SAMPLES];
+   s->start = start - profile_start_cycles;
+   s->cycles = end - start;
+   s->ring = r->number;
+   s->op = op | (result ? VQF_TRACE_RESULT : 0);
+   s->block = (hash >> v.key_remainder_bits) / QUQU_BUCKETS_PER_BLOCK;
+   s->alt_block = vqf::alt_block_index(v, hash, hash & TAG_MASK) / QUQU_BUCKETS_PER_BLOCK;
+   s->block_free = profile_block_free(filter, s->block);
+   s->alt_free = profile_block_free(filter, s->alt_block);
+   __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void vqf_profile_collect(std::vector<vqf_profile_sample>& samples) {
+   pthread_mutex_lock(&profile_lock);
+   std::vector<vqf_profile_sample> copy(VQF_PROFILE_RING_SAMPLES);
+   for (size_t i = 0; i < profile_rings.size(); i++) {
+      profile_ring *r = profile_rings[i];
+      uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      uint64_t first = head > VQF_PROFILE_RING_SAMPLES ? head - VQF_PROFILE_RING_SAMPLES : 0;
+      for (uint64_t j = first; j < head; j++)
+         copy[j - first] = r->samples[j % VQF_PROFILE_RING_SAMPLES];
+      // the owner may since have overwritten the oldest samples, and may be
+      // writing over the one after the last it published
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      uint64_t now = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+      uint64_t keep = now >= VQF_PROFILE_RING_SAMPLES ? now - VQF_PROFILE_RING_SAMPLES + 1 : 0;
+      // drop the samples of an earlier run, and those of an operation that
+      // began before vqf_profile_start, whose time wraps around
+      uint64_t min_head = __atomic_load_n(&r->min_head, __ATOMIC_RELAXED);
+      for (uint64_t j = std::max({first, keep, min_head}); j < head; j++)
+         if (copy[j - first].start < (1ULL << 63))
+            samples.push_back(copy[j - first]);
+   }
+   pthread_mutex_unlock(&profile_lock);
+}
+
+uint64_t vqf_profile_dump(FILE *fp) {
+   static const char *op_names[VQF_TRACE_NUM_OPS] = {"insert", "remove", "is_present", "query"};
+   std::vector<vqf_profile_sample> samples;
+   vqf_profile_collect(samples);
+   std::sort(samples.begin(), samples.end(),
+         [](const vqf_profile_sample& a, const vqf_profile_sample& b) { return a.start < b.start; });
+
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   uint64_t cycles = __rdtsc() - profile_start_cycles;
+   double nsec = 1e9 * (now.tv_sec - profile_start_time.tv_sec) +
+      (now.tv_nsec - profile_start_time.tv_nsec);
+   double nsec_per_cycle = cycles > 0 ? nsec / cycles : 1;
+
+   fprintf(fp, "# %lu samples, 1 in %u operations, %.4f ns per cycle\n", samples.size(),
+         profile_last_period, nsec_per_cycle);
+   fprintf(fp, "%14s %4s %-10s %6s %10s %4s %10s %4s %8s %8s\n", "time_ns", "ring", "op",
+         "result", "block", "free", "alt_block", "free", "cycles", "ns");
+   for (size_t i = 0; i < samples.size(); i++) {
+      const vqf_profile_sample *s = &samples[i];
+      fprintf(fp, "%14.0f %4u %-10s %6d %10lu %4u %10lu %4u %8u %8.0f\n",
+            s->start * nsec_per_cycle, s->ring, op_names[s->op & ~VQF_TRACE_RESULT],
+            (s->op & VQF_TRACE_RESULT) != 0, s->block, s->block_free, s->alt_block,
+            s->alt_free, s->cycles, s->cycles * nsec_per_cycle);
+   }
+   return samples.size();
 }
 
+static inline bool traced(vqf_filter *filter) {
+   return __builtin_expect(filter == __atomic_load_n(&vqf_traced_filter, __ATOMIC_RELAXED), 0);
+}
 
+// The C API is a thin wrapper over the inline operations in vqf_inline.h.
+bool vqf_insert(vqf_filter * restrict filter, uint64_t hash){
 
-static inline bool retrieve_values(vqf_filter * restrict filter, uint64_t tag, uint64_t block_index, std::vector<uint8_t>& values){
+   uint8_t default_val = 0;
 
-        uint64_t mask = generate_match_mask(filter, tag, block_index);
+   return vqf_insert_val(filter, hash, default_val);
 
-        uint64_t index = block_index / QUQU_BUCKETS_PER_BLOCK;
+}
 
-        if(mask == 0) return false;
+bool vqf_insert_val(vqf_filter * restrict filter, uint64_t hash, uint8_t val) {
+   VQF_PROBE3(insert_entry, filter, hash, val);
+   uint64_t start;
+   bool sampled = vqf_profile_begin(&start);
+   bool ret = vqf::insert<VQF_THREAD_SAFE>(vqf::make_view(filter), hash, val);
+   VQF_PROBE3(insert_return, filter, hash, ret);
+   if (sampled)
+      vqf_profile_record(filter, VQF_TRACE_INSERT, hash, ret, start);
+   if (traced(filter))
+      vqf_trace_record(filter, VQF_TRACE_INSERT, hash, val, ret);
+   return ret;
+}
 
-        int i = 0;
-        while (mask > 0) {
-            if (mask & 1) {  // Check if the least significant bit is set
-                uint16_t pair = filter->blocks[index].tags[i];
-                values.push_back(pair >> 8);
-             }
-            mask >>= 1;  // Shift the bits to the right
-            i++;
-        }
-        return true;
+bool vqf_remove(vqf_filter * restrict filter, uint64_t hash) {
+   VQF_PROBE2(remove_entry, filter, hash);
+   uint64_t start;
+   bool sampled = vqf_profile_begin(&start);
+   bool ret = vqf::remove<VQF_THREAD_SAFE>(vqf::make_view(filter), hash);
+   VQF_PROBE3(remove_return, filter, hash, ret);
+   if (sampled)
+      vqf_profile_record(filter, VQF_TRACE_REMOVE, hash, ret, start);
+   if (traced(filter))
+      vqf_trace_record(filter, VQF_TRACE_REMOVE, hash, 0, ret);
+   return ret;
 }
 
-// If the item goes in the i'th slot (starting from 0) in the block then
-// select(i) - i is the slot index for the end of the run.
 bool vqf_is_present(vqf_filter * restrict filter, uint64_t hash) {
-   vqf_metadata * restrict metadata           = &filter->metadata;
-   //vqf_block    * restrict blocks             = filter->blocks;
-   uint64_t                 key_remainder_bits = metadata->key_remainder_bits;
-   uint64_t                 range              = metadata->range;
-
-   uint64_t block_index = hash >> key_remainder_bits;
-   uint64_t tag = hash & TAG_MASK;
-
-   uint64_t alt_block_index = ((hash ^ (tag * 0x5bd1e995)) % range) >> key_remainder_bits;
-
-   __builtin_prefetch(&filter->blocks[alt_block_index / QUQU_BUCKETS_PER_BLOCK]);
-
-   return check_tags(filter, tag, block_index) || check_tags(filter, tag, alt_block_index);
-
-   /*if (!ret) {*/
-   /*printf("tag: %ld offset: %ld\n", tag, block_index % QUQU_SLOTS_PER_BLOCK);*/
-   /*print_block(filter, block_index / QUQU_SLOTS_PER_BLOCK);*/
-   /*print_block(filter, alt_block_index / QUQU_SLOTS_PER_BLOCK);*/
-   /*}*/
-}
+   VQF_PROBE2(query_entry, filter, hash);
+   uint64_t start;
+   bool sampled = vqf_profile_begin(&start);
+   bool ret = vqf::is_present(vqf::make_view(filter), hash);
+   VQF_PROBE3(query_return, filter, hash, ret);
+   if (sampled)
+      vqf_profile_record(filter, VQF_TRACE_IS_PRESENT, hash, ret, start);
+   if (traced(filter))
+      vqf_trace_record(filter, VQF_TRACE_IS_PRESENT, hash, 0, ret);
+   return ret;
+}
+
+// Traced as a query that found the first value appended, the one vqf_query
+// returns.
 bool vqf_query_iter(vqf_filter * restrict filter, uint64_t hash, std::vector<uint8_t>& values){
-    vqf_metadata * restrict metadata           = &filter->metadata;
-    //vqf_block    * restrict blocks             = filter->blocks;
-    uint64_t                 key_remainder_bits = metadata->key_remainder_bits;
-    uint64_t                 range              = metadata->range;
-
-    uint64_t block_index = hash >> key_remainder_bits;
-    uint64_t tag = hash & TAG_MASK;
-    uint64_t alt_block_index = ((hash ^ (tag * 0x5bd1e995)) % range) >> key_remainder_bits;
-
-    __builtin_prefetch(&filter->blocks[alt_block_index / QUQU_BUCKETS_PER_BLOCK]);
-
-    return retrieve_values(filter, tag, block_index, values) || retrieve_values(filter, tag, alt_block_index, values);
-
+   VQF_PROBE2(query_entry, filter, hash);
+   uint64_t start;
+   bool sampled = vqf_profile_begin(&start);
+   size_t old_size = values.size();
+   bool ret = vqf::query_iter(vqf::make_view(filter), hash, values);
+   VQF_PROBE3(query_return, filter, hash, ret);
+   if (sampled)
+      vqf_profile_record(filter, VQF_TRACE_QUERY, hash, ret, start);
+   if (traced(filter))
+      vqf_trace_record(filter, VQF_TRACE_QUERY, hash, ret ? values[old_size] : 0, ret);
+   return ret;
 }
-bool vqf_query(vqf_filter * restrict filter, uint64_t hash, uint8_t & value){
-
-   vqf_metadata * restrict metadata           = &filter->metadata;
-   //vqf_block    * restrict blocks             = filter->blocks;
-   uint64_t                 key_remainder_bits = metadata->key_remainder_bits;
-   uint64_t                 range              = metadata->range;
-
-   uint64_t block_index = hash >> key_remainder_bits;
-   uint64_t tag = hash & TAG_MASK;
-   uint64_t alt_block_index = ((hash ^ (tag * 0x5bd1e995)) % range) >> key_remainder_bits;
-
-   __builtin_prefetch(&filter->blocks[alt_block_index / QUQU_BUCKETS_PER_BLOCK]);
-
-   return retrieve_value(filter, tag, block_index, value) || retrieve_value(filter, tag, alt_block_index, value);
-
 
+bool vqf_query(vqf_filter * restrict filter, uint64_t hash, uint8_t & value){
+   VQF_PROBE2(query_entry, filter, hash);
+   uint64_t start;
+   bool sampled = vqf_profile_begin(&start);
+   bool ret = vqf::query(vqf::make_view(filter), hash, value);
+   VQF_PROBE3(query_return, filter, hash, ret);
+   if (sampled)
+      vqf_profile_record(filter, VQF_TRACE_QUERY, hash, ret, start);
+   if (traced(filter))
+      vqf_trace_record(filter, VQF_TRACE_QUERY, hash, ret ? value : 0, ret);
+   return ret;
 }
-
@@ -0,0 +1,654 @@
+/*
+ * ============================================================================
+ *
+ *       Filename:  workload.cc
+ *
+ *    Description:  YCSB-style mixed workload driver. The filter is prefilled
+ *                  to a target load factor, then every thread runs its own
+ *                  pregenerated stream of inserts, positive and negative
+ *                  queries, removes and increments in the requested ratios.
+ *                  Reports throughput and per-operation latency percentiles
+ *                  from sampled rdtscp timings (see latency_histogram.h).
+ *
+ *                  Each thread owns a disjoint set of keys, so the stream
+ *                  generator knows which keys are in the filter when it picks
+ *                  one for a query, remove or increment.
+ *
+ *                  With -R or -O the threads run open loop: operation i of a
+ *                  thread is due at a fixed offset from the start, and its
+ *                  latency is measured from that intended time, so time spent
+ *                  queued behind a slow operation is counted (coordinated
+ *                  omission correction).
+ *
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "vqf_filter.h"
+#include "vqf_inline.h"
+#include "vqf_trace.h"
+#include "vqf_profile.h"
+#include "latency_histogram.h"
+#include "zipf.h"
+#include "bench_report.h"
+
+enum op_type {
+   OP_INSERT,
+   OP_POSITIVE_QUERY,
+   OP_NEGATIVE_QUERY,
+   OP_REMOVE,
+   OP_INCREMENT,
+   NUM_OP_TYPES
+};
+
+static const char *op_names[NUM_OP_TYPES] = {
+   "insert", "positive query", "negative query", "remove", "increment"
+};
+
+// What counts as a failure for each type: a full filter, a missed key, a
+// false positive, a key not found, and a key not found before the update.
+static const char *failure_names[NUM_OP_TYPES] = {
+   "full", "missed", "false positive", "not found", "not found"
+};
+
+typedef struct workload_config {
+   uint64_t qbits;
+   uint64_t nops;
+   uint32_t nthreads;
+   double load_factor;
+   double weights[NUM_OP_TYPES];
+   bool zipfian;
+   double exponent;
+   uint64_t sample_mask;
+   uint64_t seed;
+   uint64_t nruns;
+   const char *resultfile;
+   // offered load in Mops/second over all threads; 0 runs closed loop
+   double rate;
+   // steps of the open-loop sweep up to the closed-loop throughput; 0 for none
+   uint32_t sweep_steps;
+   // file the first run is traced to through the C API; NULL for none
+   const char *trace;
+   // file the sampled operations of every run are dumped to; NULL for none
+   const char *profile;
+   uint32_t profile_period;
+} workload_config;
+
+typedef struct op {
+   uint64_t hash;
+   uint8_t type;
+} op;
+
+typedef struct thread_state {
+   pthread_t thread;
+   uint32_t id;
+   const workload_config *config;
+   vqf::view v;
+   // the filter while its run goes through the C API to be traced or
+   // profiled, else NULL
+   vqf_filter *api;
+   pthread_barrier_t *start;
+   // TSC cycles between the intended starts of two operations; 0 for closed loop
+   double cycles_per_op;
+
+   std::vector<uint64_t> prefill;
+   std::vector<op> ops;
+
+   uint64_t prefill_failures;
+   uint64_t failures[NUM_OP_TYPES];
+   latency_histogram latencies[NUM_OP_TYPES];
+} thread_state;
+
+static uint64_t now_nsec(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+// Keys of thread id: the counter'th key it inserts, and the rank'th key it
+// queries that was never inserted. mix64 is a bijection, so keys of different
+// threads and counters never coincide before the reduction to the range.
+static inline uint64_t thread_key(const workload_config *c, uint32_t id, uint64_t counter,
+      uint64_t range) {
+   return mix64((counter * c->nthreads + id) ^ c->seed) % range;
+}
+
+static inline uint64_t absent_key(const workload_config *c, uint32_t id, uint64_t rank,
+      uint64_t range) {
+   return mix64((rank * c->nthreads + id) ^ ~c->seed) % range;
+}
+
+// Picks an index in [0, size) under the configured distribution. Zipfian ranks
+// are folded onto the live keys, so the hottest keys are the oldest ones.
+static inline uint64_t pick(const workload_config *c, const zipf_sampler *z,
+      struct drand48_data *rand, uint64_t size) {
+   if (c->zipfian)
+      return (zipf_sample(z, rand) - 1) % size;
+   double r;
+   drand48_r(rand, &r);
+   return (uint64_t)(r * size) % size;
+}
+
+// Builds the prefill keys and the operation stream of one thread, tracking
+// the thread's live keys so queries, removes and increments hit present keys.
+static void gen_stream(thread_state *t, uint64_t nslots) {
+   const workload_config *c = t->config;
+   uint64_t range = t->v.range;
+   uint64_t nprefill = c->load_factor * nslots / c->nthreads;
+   uint64_t nops = c->nops / c->nthreads + (t->id < c->nops % c->nthreads);
+   uint64_t counter = 0;
+   struct drand48_data rand;
+   zipf_sampler z;
+   double total = 0, cumulative[NUM_OP_TYPES];
+
+   srand48_r(c->seed ^ t->id, &rand);
+   zipf_sampler_init(&z, std::max<uint64_t>(nprefill, 1), c->exponent);
+   for (int i = 0; i < NUM_OP_TYPES; i++)
+      cumulative[i] = total += c->weights[i];
+
+   std::vector<uint64_t> live;
+   live.reserve(nprefill + nops);
+   for (; counter < nprefill; counter++)
+      live.push_back(thread_key(c, t->id, counter, range));
+   t->prefill = live;
+
+   t->ops.resize(nops);
+   for (uint64_t i = 0; i < nops; i++) {
+      double r;
+      drand48_r(&rand, &r);
+      int type = 0;
+      while (type < NUM_OP_TYPES - 1 && r * total >= cumulative[type])
+         type++;
+      if (live.empty() && type != OP_NEGATIVE_QUERY)
+         type = OP_INSERT;
+
+      uint64_t hash;
+      if (type == OP_INSERT) {
+         hash = thread_key(c, t->id, counter++, range);
+         live.push_back(hash);
+      } else if (type == OP_NEGATIVE_QUERY) {
+         hash = absent_key(c, t->id, pick(c, &z, &rand, std::max<uint64_t>(nprefill, 1)), range);
+      } else {
+         uint64_t index = pick(c, &z, &rand, live.size());
+         hash = live[index];
+         if (type == OP_REMOVE) {
+            live[index] = live.back();
+            live.pop_back();
+         }
+      }
+      t->ops[i].hash = hash;
+      t->ops[i].type = type;
+   }
+}
+
+static inline bool run_op(const vqf::view& v, const op& o) {
+   switch (o.type) {
+      case OP_INSERT:
+         return vqf::insert(v, o.hash);
+      case OP_POSITIVE_QUERY:
+         return vqf::is_present(v, o.hash);
+      case OP_NEGATIVE_QUERY:
+         return !vqf::is_present(v, o.hash);
+      case OP_REMOVE:
+         return vqf::remove(v, o.hash);
+      default: {
+         // read-modify-write of the value stored with the key
+         uint8_t val = 0;
+         bool found = vqf::query(v, o.hash, val);
+         if (found)
+            vqf::remove(v, o.hash);
+         return vqf::insert(v, o.hash, val + 1) && found;
+      }
+   }
+}
+
+// The same operations through the C API, which traces and profiles them.
+static bool run_api_op(vqf_filter *filter, const op& o) {
+   switch (o.type) {
+      case OP_INSERT:
+         return vqf_insert(filter, o.hash);
+      case OP_POSITIVE_QUERY:
+         return vqf_is_present(filter, o.hash);
+      case OP_NEGATIVE_QUERY:
+         return !vqf_is_present(filter, o.hash);
+      case OP_REMOVE:
+         return vqf_remove(filter, o.hash);
+      default: {
+         uint8_t val = 0;
+         bool found = vqf_query(filter, o.hash, val);
+         if (found)
+            vqf_remove(filter, o.hash);
+         return vqf_insert_val(filter, o.hash, val + 1) && found;
+      }
+   }
+}
+
+static inline bool do_op(const thread_state *t, const op& o) {
+   return t->api ? run_api_op(t->api, o) : run_op(t->v, o);
+}
+
+// Issues operation i at start + i * cycles_per_op, or at once if the thread is
+// behind schedule, and times it from the intended start. The clock is read
+// only while waiting and for sampled operations, so a thread that has fallen
+// behind pays one read per operation.
+static void run_open_loop(thread_state *t) {
+   uint64_t start = latency_now(), now = start;
+   for (uint64_t i = 0; i < t->ops.size(); i++) {
+      const op& o = t->ops[i];
+      uint64_t intended = start + (uint64_t)(i * t->cycles_per_op);
+      while (now < intended) {
+         now = __rdtsc();
+         if (now < intended)
+            _mm_pause();
+      }
+      bool ok = do_op(t, o);
+      if (latency_sampled(i, t->config->sample_mask)) {
+         now = latency_now();
+         latency_record(&t->latencies[o.type], now - intended);
+      }
+      t->failures[o.type] += !ok;
+   }
+}
+
+static void *run_thread(void *arg) {
+   thread_state *t = (thread_state *)arg;
+
+   t->prefill_failures = 0;
+   for (uint64_t i = 0; i < t->prefill.size(); i++)
+      t->prefill_failures += t->api ? !vqf_insert(t->api, t->prefill[i]) :
+         !vqf::insert(t->v, t->prefill[i]);
+
+   pthread_barrier_wait(t->start);
+   if (t->cycles_per_op > 0) {
+      run_open_loop(t);
+      return NULL;
+   }
+   for (uint64_t i = 0; i < t->ops.size(); i++) {
+      const op& o = t->ops[i];
+      bool ok;
+      if (latency_sampled(i, t->config->sample_mask)) {
+         uint64_t start = latency_now();
+         ok = do_op(t, o);
+         latency_record(&t->latencies[o.type], latency_now() - start);
+      } else {
+         ok = do_op(t, o);
+      }
+      t->failures[o.type] += !ok;
+   }
+   return NULL;
+}
+
+static void report(thread_state *threads, const workload_config *c, uint64_t elapsed_nsec,
+      const vqf_stats *stats) {
+   uint64_t nprefill = 0, prefill_failures = 0;
+   for (uint32_t i = 0; i < c->nthreads; i++) {
+      nprefill += threads[i].prefill.size();
+      prefill_failures += threads[i].prefill_failures;
+   }
+   printf("Prefilled %lu keys (load factor %.2f), %lu failed\n", nprefill, c->load_factor,
+         prefill_failures);
+   vqf_print_stats(stdout, stats);
+   printf("Throughput: %.2f Mops/second (%lu operations on %u threads in %.3f seconds)\n",
+         1000.0 * c->nops / elapsed_nsec, c->nops, c->nthreads, elapsed_nsec / 1e9);
+
+   latency_print_header(stdout, "latency (ns)");
+   static latency_histogram all;
+   for (int type = 0; type < NUM_OP_TYPES; type++) {
+      latency_reset(&all);
+      for (uint32_t i = 0; i < c->nthreads; i++)
+         latency_merge(&all, &threads[i].latencies[type]);
+      latency_print(stdout, op_names[type], &all);
+   }
+
+   printf("%-20s %10s\n", "failures", "count");
+   for (int type = 0; type < NUM_OP_TYPES; type++) {
+      uint64_t failures = 0, nops = 0;
+      for (uint32_t i = 0; i < c->nthreads; i++) {
+         failures += threads[i].failures[type];
+         for (uint64_t j = 0; j < threads[i].ops.size(); j++)
+            nops += threads[i].ops[j].type == type;
+      }
+      if (nops > 0)
+         printf("%-20s %10lu %s\n", op_names[type], failures, failure_names[type]);
+   }
+}
+
+// Prefills a fresh filter and runs every thread's stream once, open loop at
+// rate Mops/second if rate > 0. The first call is traced if c->trace is set.
+// Leaves the final state of the filter in stats and returns the nanoseconds
+// from the end of the prefill to the last thread finishing.
+static uint64_t run_workload(thread_state *threads, const workload_config *c, uint64_t nslots,
+      double rate, vqf_stats *stats) {
+   vqf_filter *filter;
+   if ((filter = vqf_init(nslots)) == NULL) {
+      fprintf(stderr, "Can't allocate vqf filter.");
+      exit(EXIT_FAILURE);
+   }
+   static bool traced = false;
+   bool tracing = c->trace && !traced;
+   if (tracing && !vqf_trace_start(filter, c->trace))
+      exit(EXIT_FAILURE);
+   traced = true;
+   for (uint32_t i = 0; i < c->nthreads; i++) {
+      threads[i].v = vqf::make_view(filter);
+      threads[i].api = tracing || c->profile ? filter : NULL;
+      threads[i].cycles_per_op = rate > 0 ? 1000.0 * c->nthreads / rate /
+         latency_nsec_per_cycle() : 0;
+      memset(threads[i].failures, 0, sizeof(threads[i].failures));
+      for (int type = 0; type < NUM_OP_TYPES; type++)
+         latency_reset(&threads[i].latencies[type]);
+   }
+
+   for (uint32_t i = 0; i < c->nthreads; i++) {
+      if (pthread_create(&threads[i].thread, NULL, &run_thread, &threads[i])) {
+         fprintf(stderr, "Error creating thread\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   // the clock starts once every thread has finished its prefill
+   pthread_barrier_wait(threads[0].start);
+   uint64_t start_nsec = now_nsec();
+   for (uint32_t i = 0; i < c->nthreads; i++) {
+      if (pthread_join(threads[i].thread, NULL)) {
+         fprintf(stderr, "Error joining thread\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+   uint64_t end_nsec = now_nsec();
+   vqf_get_stats(filter, stats);
+   if (tracing && !vqf_trace_stop()) {
+      fprintf(stderr, "Could not write the trace to %s\n", c->trace);
+      exit(EXIT_FAILURE);
+   }
+   free(filter);
+   return end_nsec - start_nsec;
+}
+
+// Finds the closed-loop throughput, then offers sweep_steps evenly spaced
+// loads up to it and prints achieved throughput against latency percentiles.
+static void sweep_offered_load(thread_state *threads, const workload_config *c,
+      uint64_t nslots, bench_report *results) {
+   double saturation = 0;
+   vqf_stats stats;
+   for (uint64_t run = 0; run < c->nruns; run++) {
+      double mops = 1000.0 * c->nops / run_workload(threads, c, nslots, 0, &stats);
+      if (mops > saturation)
+         saturation = mops;
+   }
+   printf("Closed-loop throughput: %.2f Mops/second\n", saturation);
+
+   static latency_histogram all;
+   printf("%8s %10s %10s %8s %8s %8s %8s %10s\n", "offered", "Mops/s", "achieved", "p50",
+         "p90", "p99", "p99.9", "max");
+   for (uint32_t step = 1; step <= c->sweep_steps; step++) {
+      double percent = 100.0 * step / c->sweep_steps;
+      double rate = saturation * step / c->sweep_steps;
+      for (uint64_t run = 0; run < c->nruns; run++) {
+         uint64_t elapsed_nsec = run_workload(threads, c, nslots, rate, &stats);
+         double scale = latency_nsec_per_cycle();
+         latency_reset(&all);
+         for (uint32_t i = 0; i < c->nthreads; i++)
+            for (int type = 0; type < NUM_OP_TYPES; type++)
+               latency_merge(&all, &threads[i].latencies[type]);
+         double achieved = 1000.0 * c->nops / elapsed_nsec;
+         printf("%7.0f%% %10.2f %10.2f %8.0f %8.0f %8.0f %8.0f %10.0f\n", percent, rate,
+               achieved, latency_percentile(&all, 0.5) * scale,
+               latency_percentile(&all, 0.9) * scale, latency_percentile(&all, 0.99) * scale,
+               latency_percentile(&all, 0.999) * scale, all.max * scale);
+         bench_report_add(results, "achieved", percent, "Mops/s", achieved);
+         bench_report_add(results, "p99", percent, "ns",
+               latency_percentile(&all, 0.99) * scale);
+      }
+   }
+   printf("Offered load in percent of the closed-loop throughput; latencies in nanoseconds\n"
+         "from each operation's intended start\n");
+}
+
+static void usage(const char *name) {
+   printf("%s [OPTIONS]\n"
+         "Options are:\n"
+         "  -n qbits       [ log_2 of filter capacity.  Default 24 ]\n"
+         "  -o nops        [ number of operations, over all threads.  Default 10000000 ]\n"
+         "  -t nthreads    [ number of threads.  Default 1 ]\n"
+         "  -l load        [ load factor the filter is prefilled to.  Default 0.85 ]\n"
+         "  -w i:p:n:r:u   [ relative weights of insert, positive query, negative\n"
+         "                   query, remove and increment.  Default 1:1:0:1:0 ]\n"
+         "  -d dist        [ key distribution, uniform or zipfian.  Default uniform ]\n"
+         "  -s exponent    [ zipfian exponent.  Default 0.99 ]\n"
+         "  -S period      [ time one operation in period, a power of two.  Default %d ]\n"
+         "  -r nruns       [ repeat the timed run on a fresh filter.  Default 1 ]\n"
+         "  -R mops        [ run open loop at this offered load, in Mops/second over\n"
+         "                   all threads.  Default closed loop ]\n"
+         "  -O steps       [ sweep the offered load open loop in steps up to the\n"
+         "                   closed-loop throughput ]\n"
+         "  -j resultfile  [ write the configuration and the median and stddev of the\n"
+         "                   throughput as JSON, or CSV if it ends in .csv ]\n"
+         "  -T tracefile   [ trace the prefill and operations of the first run, for\n"
+         "                   replay ]\n"
+         "  -P profilefile [ sample operations of every run with the profiler and\n"
+         "                   dump the rings at the end ]\n"
+         "  -p period      [ profile one operation in about period.  Default %d ]\n",
+         name, LATENCY_SAMPLE_PERIOD, VQF_PROFILE_PERIOD);
+}
+
+static bool parse_weights(const char *arg, double *weights) {
+   char *term;
+   for (int i = 0; i < NUM_OP_TYPES; i++) {
+      weights[i] = strtod(arg, &term);
+      if (term == arg || weights[i] < 0 || *term != (i < NUM_OP_TYPES - 1 ? ':' : '\0'))
+         return false;
+      arg = term + 1;
+   }
+   for (int i = 0; i < NUM_OP_TYPES; i++)
+      if (weights[i] > 0)
+         return true;
+   return false;
+}
+
+int main(int argc, char **argv)
+{
+   workload_config config = {24, 10000000, 1, 0.85, {1, 1, 0, 1, 0}, false, 0.99,
+      LATENCY_SAMPLE_PERIOD - 1, 0, 1, NULL, 0, 0, NULL, NULL, VQF_PROFILE_PERIOD};
+   uint64_t period;
+   int opt;
+   char *term;
+
+   while ((opt = getopt(argc, argv, "n:o:t:l:w:d:s:S:r:j:R:O:T:P:p:")) != -1) {
+      switch (opt) {
+         case 'n':
+            config.qbits = strtoull(optarg, &term, 10);
+            break;
+         case 'o':
+            config.nops = strtoull(optarg, &term, 10);
+            break;
+         case 't':
+            config.nthreads = strtoul(optarg, &term, 10);
+            break;
+         case 'l':
+            config.load_factor = strtod(optarg, &term);
+            break;
+         case 'w':
+            term = (char *)"";
+            if (!parse_weights(optarg, config.weights)) {
+               fprintf(stderr, "Argument to -w must be five non-negative weights, not all 0\n");
+               exit(1);
+            }
+            break;
+         case 'd':
+            term = (char *)"";
+            if (strcmp(optarg, "zipfian") == 0)
+               config.zipfian = true;
+            else if (strcmp(optarg, "uniform") != 0)
+               term = optarg;
+            break;
+         case 's':
+            config.exponent = strtod(optarg, &term);
+            break;
+         case 'S':
+            period = strtoull(optarg, &term, 10);
+            if (period == 0 || (period & (period - 1)) != 0)
+               term = optarg;
+            config.sample_mask = period - 1;
+            break;
+         case 'r':
+            config.nruns = strtoull(optarg, &term, 10);
+            break;
+         case 'j':
+            term = (char *)"";
+            config.resultfile = optarg;
+            break;
+         case 'R':
+            config.rate = strtod(optarg, &term);
+            if (config.rate <= 0)
+               term = optarg;
+            break;
+         case 'O':
+            config.sweep_steps = strtoul(optarg, &term, 10);
+            if (config.sweep_steps == 0)
+               term = optarg;
+            break;
+         case 'T':
+            term = (char *)"";
+            config.trace = optarg;
+            break;
+         case 'P':
+            term = (char *)"";
+            config.profile = optarg;
+            break;
+         case 'p':
+            config.profile_period = strtoul(optarg, &term, 10);
+            if (config.profile_period == 0)
+               term = optarg;
+            break;
+         default:
+            usage(argv[0]);
+            exit(1);
+      }
+      if (*term) {
+         fprintf(stderr, "Invalid argument to -%c: %s\n", opt, optarg);
+         usage(argv[0]);
+         exit(1);
+      }
+   }
+   if (config.nthreads == 0 || config.nruns == 0 || config.load_factor < 0 || config.load_factor >= 1 ||
+         config.exponent <= 0) {
+      usage(argv[0]);
+      exit(1);
+   }
+   if (config.nthreads > 1 && !VQF_THREAD_SAFE) {
+      fprintf(stderr, "Build with THREAD=1 to run more than one thread.\n");
+      exit(1);
+   }
+   RAND_bytes((unsigned char *)&config.seed, sizeof(config.seed));
+
+   uint64_t nslots = 1ULL << config.qbits;
+   vqf_filter *filter;
+
+   double total = 0;
+   for (int i = 0; i < NUM_OP_TYPES; i++)
+      total += config.weights[i];
+   printf("Workload: %s keys", config.zipfian ? "zipfian" : "uniform");
+   if (config.zipfian)
+      printf(" (exponent %.2f)", config.exponent);
+   printf(", mix");
+   for (int i = 0; i < NUM_OP_TYPES; i++)
+      printf(" %s %.1f%%%s", op_names[i], 100 * config.weights[i] / total,
+            i < NUM_OP_TYPES - 1 ? "," : "\n");
+   printf("Filter kernels: %s tag shift, %s match\n", VQF_TAG_SHIFT_KERNEL, VQF_MATCH_KERNEL);
+
+   bench_report results;
+   char mix[128];
+   snprintf(mix, sizeof(mix), "%g:%g:%g:%g:%g", config.weights[0], config.weights[1],
+         config.weights[2], config.weights[3], config.weights[4]);
+   bench_report_config(&results, "program", "workload");
+   bench_report_config(&results, "nslots", nslots);
+   bench_report_config(&results, "load_factor", config.load_factor);
+   bench_report_config(&results, "tag_shift", VQF_TAG_SHIFT_KERNEL);
+   bench_report_config(&results, "tag_match", VQF_MATCH_KERNEL);
+   bench_report_config(&results, "threads", config.nthreads);
+   bench_report_config(&results, "distribution", config.zipfian ? "zipfian" : "uniform");
+   if (config.zipfian)
+      bench_report_config(&results, "exponent", config.exponent);
+   bench_report_config(&results, "mix", mix);
+   bench_report_config(&results, "nops", config.nops);
+
+   if (config.rate > 0)
+      bench_report_config(&results, "offered_mops", config.rate);
+
+   // every run replays the same streams on a fresh filter; this one only
+   // gives gen_stream the range
+   if ((filter = vqf_init(nslots)) == NULL) {
+      fprintf(stderr, "Can't allocate vqf filter.");
+      exit(EXIT_FAILURE);
+   }
+   pthread_barrier_t start;
+   pthread_barrier_init(&start, NULL, config.nthreads + 1);
+   thread_state *threads = new thread_state[config.nthreads];
+   for (uint32_t i = 0; i < config.nthreads; i++) {
+      threads[i].id = i;
+      threads[i].config = &config;
+      threads[i].start = &start;
+      threads[i].v = vqf::make_view(filter);
+      gen_stream(&threads[i], nslots);
+   }
+   free(filter);
+   // calibrate the TSC before any thread paces itself with it
+   latency_nsec_per_cycle();
+   if (config.profile)
+      vqf_profile_start(config.profile_period);
+
+   if (config.sweep_steps > 0) {
+      sweep_offered_load(threads, &config, nslots, &results);
+   } else {
+      for (uint64_t run = 0; run < config.nruns; run++) {
+         vqf_stats stats;
+         uint64_t elapsed_nsec = run_workload(threads, &config, nslots, config.rate, &stats);
+         if (config.nruns > 1)
+            printf("Run %lu\n", run);
+         if (config.rate > 0)
+            printf("Open loop at %.2f Mops/second offered; latencies from intended start\n",
+                  config.rate);
+         report(threads, &config, elapsed_nsec, &stats);
+         bench_report_add(&results, "mixed", 100 * config.load_factor, "Mops/s",
+               1000.0 * config.nops / elapsed_nsec);
+      }
+
+      if (config.nruns > 1) {
+         bench_result *res = &results.results[0];
+         bench_result_stats(res);
+         printf("Throughput over %lu runs: median %.2f Mops/second, stddev %.2f\n", res->runs,
+               res->median, res->stddev);
+      }
+   }
+   if (config.profile) {
+      vqf_profile_stop();
+      FILE *fp = fopen(config.profile, "w");
+      if (fp == NULL) {
+         perror(config.profile);
+         exit(EXIT_FAILURE);
+      }
+      uint64_t nsamples = vqf_profile_dump(fp);
+      fclose(fp);
+      printf("Wrote %lu profile samples to %s\n", nsamples, config.profile);
+   }
+   vqf_events events;
+   if (vqf_get_events(&events))
+      vqf_print_events(stdout, &events);
+   if (config.resultfile && !bench_report_write(&results, config.resultfile))
+      exit(EXIT_FAILURE);
+
+   pthread_barrier_destroy(&start);
+   delete[] threads;
+   return 0;
+}